@@ -16,6 +16,7 @@
 #include "lwip/tcp.h"
 #include "lwip/dns.h"
 #include "httpclient.h"
+#include "dns_cache.h"
 
 // Debug output.
 #if 1
@@ -24,45 +25,113 @@
 #define PRINTF(...)
 #endif
 
+// Position of the header tokenizer.
+typedef enum {
+	HS_VERSION,      // "HTTP/1.x "
+	HS_STATUS,       // Status code
+	HS_REASON,       // Rest of the status line
+	HS_LINE_START,
+	HS_NAME,         // Field name, matched against header_names
+	HS_VALUE_START,  // Whitespace after the colon
+	HS_VALUE,
+	HS_SKIP_LINE,    // A field that isn't needed
+	HS_DONE          // The empty line after the header was seen
+} header_token_state;
+
+// Header fields that are parsed, the names are in lowercase.
+typedef enum {
+	HF_CONTENT_LENGTH,
+	HF_TRANSFER_ENCODING,
+	HF_DATE,
+	HF_ETAG,
+	HF_CONTENT_ENCODING,
+	HF_LAST_MODIFIED,
+	HF_CONNECTION,
+	HF_COUNT
+} header_field;
+
+static const char * const header_names[HF_COUNT] = {
+	"content-length",
+	"transfer-encoding",
+	"date",
+	"etag",
+	"content-encoding",
+	"last-modified",
+	"connection"
+};
+
 typedef enum {
 	PS_PARSING_HEADER,
 	PS_PARSING_BODY,
-	PS_PARSING_CHUNKED_BODY
+	PS_PARSING_CHUNK_SIZE,   // Hex digits of a chunk size line
+	PS_PARSING_CHUNK_EXT,    // Rest of the size line, skipped
+	PS_PARSING_CHUNK_DATA,
+	PS_PARSING_CHUNK_END,    // CRLF after the data of a chunk
+	PS_PARSING_TRAILER,
+	PS_COMPLETE      // The whole response was received
 } header_parse_state;
 
-// Internal state.
-typedef struct {
+// Internal state of a request. It is allocated in one block that also holds
+// its strings.
+typedef struct request_args {
+	struct request_args * next; // Queued after this one.
 	char * path;
-	int port;
 	char * post_data;
 	char * headers;
-	char * hostname;
-	char * buffer;
-	int buffer_size;
-	bool secure;
+	bool post;                  // Not retried on a new connection.
 	http_callback user_callback;
-	int current_chunk_size;
-	int buffer_allocated_size;
+	int current_chunk_size; // Bytes left of the chunk being received.
+	int body_remaining; // Bytes left of a Content-Length body, or -1.
 	header_parse_state parse_state;
+	http_header header;
+	// Header tokenizer state, kept across packets.
+	unsigned char header_state;   // header_token_state
+	unsigned char header_field;   // header_field of the current line
+	unsigned char header_pos;     // Characters matched or stored so far
+	unsigned char header_names;   // Bit set of header_names still matching
 } request_args;
 
+/*
+ * The requests to one host run one at a time, the head of the queue is the
+ * request in progress. The TCP connection is kept open between them while
+ * the server allows it.
+ */
+struct http_connection {
+	char * hostname;        // Allocated after the struct.
+	int port;
+	bool secure;
+	ip_addr_t addr;
+	uint32_t dns_start;     // Times for http_timing.
+	uint32_t dns_end;
+	uint32_t connected;
+	struct tcp_pcb * pcb;   // NULL while not connected.
+	bool reused;            // A response was already received on pcb.
+	request_args * queue;
+};
+
+// Set by http_abort() from within a user callback.
+static bool abort_requested = false;
+
 int DEBUG_printf(const char *fmt, ...)
 {
 	/* Dummy DEBUG_printf required by the open source lwIP implementation */
 	return 0;
 }
 
-static char * ICACHE_FLASH_ATTR esp_strdup(const char * str)
+static size_t ICACHE_FLASH_ATTR arena_size(const char * str)
 {
+	return str != NULL ? os_strlen(str) + 1 : 0; // 1 for null character
+}
+
+// Copy a string to the free space of a block and move past it.
+static char * ICACHE_FLASH_ATTR arena_strdup(char ** arena, const char * str)
+{
+	char * new_str = *arena;
 	if (str == NULL) {
 		return NULL;
 	}
-	char * new_str = (char *)os_malloc(os_strlen(str) + 1); // 1 for null character
-	if (new_str == NULL) {
-		os_printf("esp_strdup: malloc error");
-		return NULL;
-	}
 	os_strcpy(new_str, str);
+	*arena += os_strlen(str) + 1;
 	return new_str;
 }
 
@@ -72,13 +141,6 @@ esp_isupper(char c)
     return (c >= 'A' && c <= 'Z');
 }
 
-static int ICACHE_FLASH_ATTR
-esp_isalpha(char c)
-{
-    return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
-}
-
-
 static int ICACHE_FLASH_ATTR
 esp_isspace(char c)
 {
@@ -91,292 +153,622 @@ esp_isdigit(char c)
     return (c >= '0' && c <= '9');
 }
 
+static void ICACHE_FLASH_ATTR free_request(request_args * req)
+{
+	os_free(req);
+}
+
+static void ICACHE_FLASH_ATTR free_connection(http_connection * conn)
+{
+	os_free(conn);
+}
+
 /*
- * Convert a string to a long integer.
- *
- * Ignores `locale' stuff.  Assumes that the upper and lower case
- * alphabets and digits are each contiguous.
+ * The request at the head of the queue has ended, tell the user and remove
+ * it. It stays at the head during the callback so that requests queued
+ * from the callback don't start on their own.
  */
-static long ICACHE_FLASH_ATTR
-esp_strtol(const char *nptr, char **endptr, int base)
-{
-	const char *s = nptr;
-	unsigned long acc;
-	int c;
-	unsigned long cutoff;
-	int neg = 0, any, cutlim;
-
-	/*
-	 * Skip white space and pick up leading +/- sign if any.
-	 * If base is 0, allow 0x for hex and 0 for octal, else
-	 * assume decimal; if base is already 16, allow 0x.
-	 */
-	do {
-		c = *s++;
-	} while (esp_isspace(c));
-	if (c == '-') {
-		neg = 1;
-		c = *s++;
-	} else if (c == '+')
-		c = *s++;
-	if ((base == 0 || base == 16) &&
-	    c == '0' && (*s == 'x' || *s == 'X')) {
-		c = s[1];
-		s += 2;
-		base = 16;
-	} else if ((base == 0 || base == 2) &&
-	    c == '0' && (*s == 'b' || *s == 'B')) {
-		c = s[1];
-		s += 2;
-		base = 2;
-	}
-	if (base == 0)
-		base = c == '0' ? 8 : 10;
-
-	/*
-	 * Compute the cutoff value between legal numbers and illegal
-	 * numbers.  That is the largest legal value, divided by the
-	 * base.  An input number that is greater than this value, if
-	 * followed by a legal input character, is too big.  One that
-	 * is equal to this value may be valid or not; the limit
-	 * between valid and invalid numbers is then based on the last
-	 * digit.  For instance, if the range for longs is
-	 * [-2147483648..2147483647] and the input base is 10,
-	 * cutoff will be set to 214748364 and cutlim to either
-	 * 7 (neg==0) or 8 (neg==1), meaning that if we have accumulated
-	 * a value > 214748364, or equal but the next digit is > 7 (or 8),
-	 * the number is too big, and we will return a range error.
-	 *
-	 * Set any if any `digits' consumed; make it negative to indicate
-	 * overflow.
-	 */
-	cutoff = neg ? -(unsigned long)LONG_MIN : LONG_MAX;
-	cutlim = cutoff % (unsigned long)base;
-	cutoff /= (unsigned long)base;
-	for (acc = 0, any = 0;; c = *s++) {
-		if (esp_isdigit(c))
-			c -= '0';
-		else if (esp_isalpha(c))
-			c -= esp_isupper(c) ? 'A' - 10 : 'a' - 10;
-		else
-			break;
-		if (c >= base)
-			break;
-		if (any < 0 || acc > cutoff || (acc == cutoff && c > cutlim))
-			any = -1;
-		else {
-			any = 1;
-			acc *= base;
-			acc += c;
-		}
+static void ICACHE_FLASH_ATTR finish_request(http_connection * conn)
+{
+	request_args * req = conn->queue;
+
+	if (req->user_callback != NULL) {
+		req->user_callback(NULL, HTTP_STATUS_DISCONNECT, &req->header, 0);
 	}
-	if (any < 0) {
-		acc = neg ? LONG_MIN : LONG_MAX;
-//		errno = ERANGE;
-	} else if (neg)
-		acc = -acc;
-	if (endptr != 0)
-		*endptr = (char *)(any ? s - 1 : nptr);
-	return (acc);
+	conn->queue = req->next;
+	free_request(req);
 }
 
-static void ICACHE_FLASH_ATTR do_cleanup(void * arg) {
-	if (arg != NULL) {
-		request_args * req = (request_args *)arg;
-		os_free(req->buffer);
-		os_free(req->hostname);
-		os_free(req->path);
-		os_free(req);
+// Fail the whole queue, for when the host can't be reached.
+static void ICACHE_FLASH_ATTR fail_connection(http_connection * conn)
+{
+	while (conn->queue != NULL) {
+		request_args * req = conn->queue;
+		if (req->user_callback != NULL) {
+			req->user_callback(NULL, HTTP_STATUS_GENERIC_ERROR, NULL, 0);
+		}
+		conn->queue = req->next;
+		free_request(req);
 	}
+	free_connection(conn);
 }
 
-static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
+static void ICACHE_FLASH_ATTR detach_connection(struct tcp_pcb * pcb)
 {
-	PRINTF("Disconnected\n");
+	tcp_arg(pcb, NULL);
+	tcp_recv(pcb, NULL);
+	tcp_sent(pcb, NULL);
+	tcp_err(pcb, NULL);
+}
 
-	if(arg != NULL) {
-		request_args * req = (request_args *)arg;
-		if (req->user_callback != NULL) {
-			req->user_callback(NULL, HTTP_STATUS_DISCONNECT, NULL, 0);
+/*
+ * Close the TCP connection without waiting for the server. Returns ERR_ABRT
+ * if it had to be aborted, which an lwIP callback of the pcb must return.
+ */
+static err_t ICACHE_FLASH_ATTR close_connection(http_connection * conn)
+{
+	struct tcp_pcb * pcb = conn->pcb;
+	err_t err = ERR_OK;
+
+	conn->pcb = NULL;
+	if (pcb != NULL) {
+		detach_connection(pcb);
+		if (tcp_close(pcb) != ERR_OK) {
+			tcp_abort(pcb);
+			err = ERR_ABRT;
 		}
 	}
-
-	do_cleanup(arg);
+	return err;
 }
 
-static bool ICACHE_FLASH_ATTR append_to_buffer(request_args * req,
-	char * data, unsigned short len) {
-	const int new_size = req->buffer_size + len;
+static bool ICACHE_FLASH_ATTR start_connection(http_connection * conn);
+static void ICACHE_FLASH_ATTR send_request(http_connection * conn);
 
-	// Let's do the equivalent of a realloc().
-	if (new_size > req->buffer_allocated_size) {
-		char * new_buffer;
-		if (new_size > BUFFER_SIZE_MAX ||
-			NULL == (new_buffer = (char *)os_malloc(new_size))) {
-			os_printf("Response too long (%d)\n", new_size);
-			req->buffer[0] = '\0'; // Discard the buffer to avoid using an incomplete response.
-			return false;
-		}
+/*
+ * Move on to the next request after the head was finished: send it on the
+ * open connection or connect again. Without one the connection is closed
+ * and freed. Returns the result of closing the pcb as close_connection.
+ */
+static err_t ICACHE_FLASH_ATTR run_queue(http_connection * conn)
+{
+	if (conn->queue == NULL) {
+		err_t err = close_connection(conn);
+		free_connection(conn);
+		return err;
+	}
 
-		os_memcpy(new_buffer, req->buffer, req->buffer_size);
-		os_free(req->buffer);
-		req->buffer = new_buffer;
-		req->buffer_allocated_size = new_size;
+	if (conn->pcb != NULL) {
+		conn->reused = true;
+		send_request(conn);
+	} else if (!start_connection(conn)) {
+		fail_connection(conn);
 	}
+	return ERR_OK;
+}
+
+/*
+ * The connection broke before the head request completed. Unless it was a
+ * reused connection that the server closed before answering, which is
+ * retried on a new connection, the request ends here.
+ */
+static void ICACHE_FLASH_ATTR connection_lost(http_connection * conn)
+{
+	request_args * req = conn->queue;
+
+	if (req != NULL && !(conn->reused && !req->post &&
+		req->parse_state == PS_PARSING_HEADER &&
+		req->header_state == HS_VERSION && req->header_pos == 0)) {
+		finish_request(conn);
+	} else if (req != NULL) {
+		PRINTF("Retrying on a new connection\n");
+	}
+	run_queue(conn);
+}
 
-	os_memcpy(req->buffer + req->buffer_size - 1 /*overwrite the null character*/, data, len); // Append new data.
-	req->buffer[new_size - 1] = '\0'; // Make sure there is an end of string.
-	req->buffer_size = new_size;
+static err_t ICACHE_FLASH_ATTR abort_connection(http_connection * conn,
+	struct pbuf * p)
+{
+	PRINTF("Aborting request\n");
+	abort_requested = false;
 
-	return true;
+	// Detach first so that lwIP doesn't report the abort back to us.
+	detach_connection(conn->pcb);
+	pbuf_free(p);
+	tcp_abort(conn->pcb);
+	conn->pcb = NULL;
+
+	finish_request(conn);
+	run_queue(conn);
+	return ERR_ABRT;
 }
 
-static bool ICACHE_FLASH_ATTR parse_header(const char * buffer,
-	int * http_status, bool * is_chunked, char ** body_start) {
-	// FIXME: make sure this is not a partial response, using the Content-Length header.
-	const char * version10 = "HTTP/1.0 ";
-	const char * version11 = "HTTP/1.1 ";
-	if (os_strncmp(buffer, version10, strlen(version10)) != 0
-	 && os_strncmp(buffer, version11, strlen(version11)) != 0) {
-		os_printf("Invalid version in %s\n", buffer);
-		return false;
-	}
+/*
+ * The response is complete. The connection stays open for the next request
+ * unless the server is going to close it, the user is told right away.
+ */
+static err_t ICACHE_FLASH_ATTR complete_connection(http_connection * conn,
+	struct pbuf * p)
+{
+	PRINTF("Response complete\n");
+	err_t err = ERR_OK;
 
-	if (http_status != NULL) {
-		*http_status = atoi(buffer + strlen(version10));
+	tcp_recved(conn->pcb, p->tot_len);
+	pbuf_free(p);
+	if (!conn->queue->header.keep_alive) {
+		err = close_connection(conn);
 	}
-	/* find the start of the body */
-	if (body_start != NULL) {
-		char * header_end = (char *)os_strstr(buffer, "\r\n\r\n");
-		if (header_end != NULL) {
-			*body_start = header_end + 2;
-		} else {
-			*body_start = NULL;
-		}
+
+	finish_request(conn);
+	if (run_queue(conn) != ERR_OK) {
+		err = ERR_ABRT;
 	}
+	return err;
+}
 
-	if (is_chunked != NULL) {
-		*is_chunked = os_strstr(buffer, "Transfer-Encoding: chunked") != NULL;
+static char ICACHE_FLASH_ATTR esp_tolower(char c)
+{
+	return esp_isupper(c) ? c - 'A' + 'a' : c;
+}
+
+// Destination of a string valued field, or NULL.
+static char * ICACHE_FLASH_ATTR header_string(http_header * header,
+	int field, size_t * size)
+{
+	switch (field) {
+	case HF_DATE:
+		*size = sizeof(header->date);
+		return header->date;
+	case HF_ETAG:
+		*size = sizeof(header->etag);
+		return header->etag;
+	case HF_CONTENT_ENCODING:
+		*size = sizeof(header->content_encoding);
+		return header->content_encoding;
+	case HF_LAST_MODIFIED:
+		*size = sizeof(header->last_modified);
+		return header->last_modified;
+	default:
+		return NULL;
 	}
-	return true;
 }
 
-static err_t ICACHE_FLASH_ATTR receive_callback(void * arg,
-	struct tcp_pcb * pcb, struct pbuf * p, err_t err) {
-	request_args * req = (request_args *)arg;
+// Lists such as "gzip, chunked" are matched against a token an element at a
+// time, with whitespace allowed only around the elements. Only the last
+// non-empty element counts. header_pos holds the characters of the token
+// matched in the current element and these flags.
+#define TOKEN_LENGTH 0x0f
+#define TOKEN_TRAILING 0x10     // Whitespace after the whole token
+#define TOKEN_MISMATCH 0x20     // The element isn't the token
+#define TOKEN_PREVIOUS 0x40     // The previous element was the token
+
+static bool ICACHE_FLASH_ATTR token_element_matched(unsigned char pos,
+	size_t len)
+{
+	return !(pos & TOKEN_MISMATCH) && (pos & TOKEN_LENGTH) == len;
+}
 
-	if (p == NULL) {
-		disconnect_callback(arg);
-		return ERR_OK;
+static bool ICACHE_FLASH_ATTR token_matched(unsigned char pos, size_t len)
+{
+	if ((pos & (TOKEN_LENGTH | TOKEN_MISMATCH)) == 0) {
+		return pos & TOKEN_PREVIOUS; // The last element is empty.
 	}
+	return token_element_matched(pos, len);
+}
 
-	char * buf = p->payload;
-	size_t len = p->len;
+static unsigned char ICACHE_FLASH_ATTR token_char(unsigned char pos,
+	const char * token, char c)
+{
+	size_t len = strlen(token);
+	size_t matched = pos & TOKEN_LENGTH;
 
-	if (req->buffer == NULL) {
-		goto success;
+	c = esp_tolower(c);
+	if (c == ',') {
+		if (pos & (TOKEN_LENGTH | TOKEN_MISMATCH)) {
+			pos = token_element_matched(pos, len) ? TOKEN_PREVIOUS : 0;
+		}
+	} else if (c == ' ' || c == '\t') {
+		if (matched == len) {
+			pos |= TOKEN_TRAILING;
+		} else if (matched > 0) {
+			pos |= TOKEN_MISMATCH;
+		}
+	} else if ((pos & (TOKEN_TRAILING | TOKEN_MISMATCH)) == 0 &&
+		matched < len && c == token[matched]) {
+		pos++;
+	} else {
+		pos |= TOKEN_MISMATCH;
 	}
+	return pos;
+}
 
-	if (!append_to_buffer(req, buf, len)) {
-		tcp_close(pcb);
-		return ERR_MEM;
+static void ICACHE_FLASH_ATTR header_value_char(request_args * req, char c)
+{
+	http_header * header = &req->header;
+	size_t size;
+	char * str;
+
+	switch (req->header_field) {
+	case HF_CONTENT_LENGTH:
+		if (esp_isdigit(c) && header->content_length >= 0 &&
+			header->content_length <= (INT_MAX - 9) / 10) {
+			header->content_length = header->content_length * 10 + c - '0';
+			req->header_pos = 1;
+		} else if (c != ' ' && c != '\t') {
+			header->content_length = -1; // Invalid or too long.
+			req->header_state = HS_SKIP_LINE;
+		}
+		break;
+	case HF_TRANSFER_ENCODING:
+		req->header_pos = token_char(req->header_pos, "chunked", c);
+		break;
+	case HF_CONNECTION:
+		req->header_pos = token_char(req->header_pos, "close", c);
+		break;
+	default:
+		str = header_string(header, req->header_field, &size);
+		if (str != NULL && req->header_pos < size - 1) {
+			str[req->header_pos++] = c;
+			str[req->header_pos] = '\0';
+		}
+		break;
 	}
+}
 
-	if (req->parse_state == PS_PARSING_HEADER) {
-		char *header_end = os_strstr(req->buffer, "\r\n\r\n") + 2;
-		if (header_end == NULL) {
-			// Not ready to parse the header yet
-			PRINTF("partial header\n");
-			goto success;
+static void ICACHE_FLASH_ATTR header_value_end(request_args * req)
+{
+	size_t size;
+	char * str;
+
+	if (req->header_field == HF_CONTENT_LENGTH && req->header_pos == 0) {
+		req->header.content_length = -1; // No digits.
+	} else if (req->header_field == HF_TRANSFER_ENCODING) {
+		req->header.chunked = token_matched(req->header_pos,
+			sizeof("chunked") - 1);
+	} else if (req->header_field == HF_CONNECTION) {
+		if (token_matched(req->header_pos, sizeof("close") - 1)) {
+			req->header.keep_alive = false;
 		}
-		int http_status = 0;
-		bool is_chunked = false;
-		if (!parse_header(req->buffer, &http_status, &is_chunked, NULL)) {
-			tcp_recved(pcb, len);
-			tcp_close(pcb);
-			return ERR_MEM;
-		} else {
-			if (is_chunked) {
-				req->parse_state = PS_PARSING_CHUNKED_BODY;
+	} else if ((str = header_string(&req->header, req->header_field, &size))) {
+		while (req->header_pos > 0 && esp_isspace(str[req->header_pos - 1])) {
+			str[--req->header_pos] = '\0';
+		}
+	}
+}
+
+/*
+ * Feed header bytes to the tokenizer. Each byte is looked at once and only
+ * the fields of http_header are kept. Returns the number of bytes used,
+ * which is less than len if the header ended, or -1 on a malformed header.
+ */
+static int ICACHE_FLASH_ATTR parse_header(request_args * req,
+	const char * data, size_t len)
+{
+	static const char version[] = "HTTP/1.";
+	http_header * header = &req->header;
+	size_t i;
+	int j;
+
+	for (i = 0; i < len && req->header_state != HS_DONE; i++) {
+		char c = data[i];
+		if (c == '\r') {
+			continue; // Lines may end with CRLF or just LF.
+		}
+		switch (req->header_state) {
+		case HS_VERSION:
+			if (req->header_pos < sizeof(version) - 1) {
+				if (c != version[req->header_pos++]) {
+					return -1;
+				}
+			} else if (req->header_pos == sizeof(version) - 1 && esp_isdigit(c)) {
+				// HTTP/1.0 servers close the connection after the response.
+				header->keep_alive = c != '0';
+				req->header_pos++;
+			} else if (c == ' ') {
+				req->header_state = HS_STATUS;
 			} else {
-				req->parse_state = PS_PARSING_BODY;
+				return -1;
 			}
-
-			*header_end = '\0';
-			if (req->user_callback != NULL) {
-				req->user_callback(NULL, http_status, req->buffer, 0);
+			break;
+		case HS_STATUS:
+			if (esp_isdigit(c) && header->status < 100) {
+				header->status = header->status * 10 + c - '0';
+			} else if (c == ' ' && header->status >= 100) {
+				req->header_state = HS_REASON;
+			} else if (c == '\n' && header->status >= 100) {
+				req->header_state = HS_LINE_START;
+			} else {
+				return -1;
+			}
+			break;
+		case HS_REASON:
+		case HS_SKIP_LINE:
+			if (c == '\n') {
+				req->header_state = HS_LINE_START;
 			}
-			*header_end = '\r';
-
-			/* In the case of a chunked body, leave the last CRLF in.
-			 * This way the parsing loop can just look for the
-			 * \r\nCHUNK SIZE\r\n boundary every time. */
-			char *body_start = req->parse_state == PS_PARSING_CHUNKED_BODY ?
-				header_end : header_end + 2;
-			/* Move the start of the body to the beginning of the buffer */
-			int body_offset = body_start - req->buffer;
-			if (body_offset < req->buffer_size) {
-				req->buffer_size -= body_offset;
-				os_memmove(req->buffer, body_start, req->buffer_size);
+			break;
+		case HS_LINE_START:
+			if (c == '\n') {
+				req->header_state = HS_DONE;
+				break;
+			} else if (c == ' ' || c == '\t') {
+				// Obsolete line folding, not supported.
+				req->header_state = HS_SKIP_LINE;
+				break;
+			}
+			req->header_state = HS_NAME;
+			req->header_names = (1 << HF_COUNT) - 1;
+			req->header_pos = 0;
+			// Fall through - the first character of the name is handled below.
+		case HS_NAME:
+			if (c == ':') {
+				req->header_state = HS_SKIP_LINE;
+				for (j = 0; j < HF_COUNT; j++) {
+					if ((req->header_names & (1 << j)) &&
+						header_names[j][req->header_pos] == '\0') {
+						req->header_state = HS_VALUE_START;
+						req->header_field = j;
+					}
+				}
+				req->header_pos = 0;
+				if (req->header_state == HS_VALUE_START &&
+					req->header_field == HF_CONTENT_LENGTH) {
+					header->content_length = 0;
+				}
+				break;
+			} else if (c == '\n') {
+				req->header_state = HS_LINE_START;
+				break;
+			}
+			for (j = 0; j < HF_COUNT; j++) {
+				// A name stops matching at its terminator at the latest.
+				if ((req->header_names & (1 << j)) &&
+					header_names[j][req->header_pos] != esp_tolower(c)) {
+					req->header_names &= ~(1 << j);
+				}
+			}
+			req->header_pos++;
+			if (req->header_names == 0) {
+				req->header_state = HS_SKIP_LINE;
+			}
+			break;
+		case HS_VALUE_START:
+			if (c == ' ' || c == '\t') {
+				break;
+			}
+			req->header_state = HS_VALUE;
+			// Fall through - the first character of the value is handled below.
+		case HS_VALUE:
+			if (c == '\n') {
+				header_value_end(req);
+				req->header_state = HS_LINE_START;
 			} else {
-				req->buffer_size = 1;
-				req->buffer[0] = '\0';
+				header_value_char(req, c);
 			}
+			break;
 		}
 	}
+	return i;
+}
 
-	if (req->user_callback == NULL) {
-		goto success;
+// Value of a hexadecimal digit, or -1.
+static int ICACHE_FLASH_ATTR esp_hexval(char c)
+{
+	if (esp_isdigit(c)) {
+		return c - '0';
 	}
+	c = esp_tolower(c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
 
-	if (req->parse_state == PS_PARSING_CHUNKED_BODY) {
-		char *read_ptr = req->buffer;
-		char *buffer_end = req->buffer + req->buffer_size - 1;  /* Ignore trailing zero */
-		do {
-			if (req->current_chunk_size == 0) {
-				char *crlf_pos_1 = os_strstr(read_ptr, "\r\n");
-				char *crlf_pos_2 = NULL;
-				if (crlf_pos_1 != NULL &&
-					(crlf_pos_2 = os_strstr(crlf_pos_1 + 2, "\r\n"))) {
-					req->current_chunk_size =
-						esp_strtol(crlf_pos_1 + 2, (char **)NULL, 16);
-					read_ptr = crlf_pos_2 + 2;
-				} else { break; }
+/*
+ * Feed the bytes between the data of two chunks to the chunk size parser:
+ * the CRLF after the data and the size line of the next chunk, whose
+ * extension is skipped. The state is kept across packets in parse_state,
+ * current_chunk_size and header_pos, which tells whether a digit was seen.
+ * Returns the number of bytes used, which is less than len once the size
+ * line ended, or -1 on a malformed line.
+ */
+static int ICACHE_FLASH_ATTR parse_chunk_size(request_args * req,
+	const char * data, size_t len)
+{
+	size_t i;
+	int digit;
+
+	for (i = 0; i < len; i++) {
+		char c = data[i];
+		if (c == '\r') {
+			continue; // Lines may end with CRLF or just LF.
+		}
+		if (req->parse_state == PS_PARSING_CHUNK_END) {
+			if (c != '\n') {
+				return -1;
+			}
+			req->parse_state = PS_PARSING_CHUNK_SIZE;
+		} else if (c == '\n') {
+			if (req->header_pos == 0) {
+				return -1; // No size.
+			}
+			req->parse_state = req->current_chunk_size > 0 ?
+				PS_PARSING_CHUNK_DATA : PS_PARSING_TRAILER;
+			req->header_pos = 0;
+			return i + 1;
+		} else if (req->parse_state == PS_PARSING_CHUNK_EXT) {
+			// Extensions aren't used.
+		} else if ((digit = esp_hexval(c)) >= 0) {
+			if (req->current_chunk_size > (INT_MAX - digit) / 16) {
+				return -1; // Too large.
+			}
+			req->current_chunk_size = req->current_chunk_size * 16 + digit;
+			req->header_pos = 1;
+		} else if (req->header_pos != 0 &&
+			(c == ';' || c == ' ' || c == '\t')) {
+			req->parse_state = PS_PARSING_CHUNK_EXT;
+		} else {
+			return -1;
+		}
+	}
+	return i;
+}
+
+static void ICACHE_FLASH_ATTR handle_header(request_args * req)
+{
+	int status = req->header.status;
+
+	// Arrival time of the pbuf that ended the header.
+	req->header.timing.header_done = req->header.timing.last_byte;
+	if (req->header.chunked) {
+		req->parse_state = PS_PARSING_CHUNK_SIZE;
+		req->current_chunk_size = 0;
+		req->header_pos = 0;
+	} else if (req->header.content_length == 0 || status == 204 ||
+		status == 304) {
+		req->parse_state = PS_COMPLETE; // No body.
+	} else {
+		// Without a Content-Length the body ends when the server closes.
+		req->parse_state = PS_PARSING_BODY;
+		req->body_remaining = req->header.content_length;
+	}
+
+	if (req->user_callback != NULL) {
+		req->user_callback(NULL, req->header.status, &req->header, 0);
+	}
+}
+
+static void ICACHE_FLASH_ATTR deliver_body(request_args * req,
+	char * data, size_t len)
+{
+	if (req->header.timing.first_body_byte == 0 && len > 0) {
+		req->header.timing.first_body_byte = req->header.timing.last_byte;
+	}
+	if (req->user_callback != NULL && len > 0) {
+		req->user_callback(data, HTTP_STATUS_BODY, NULL, len);
+	}
+}
+
+/*
+ * Handle the data of one pbuf. Nothing is copied, the header and the chunk
+ * framing are parsed a byte at a time and body data goes to the user
+ * callback straight from the pbuf. Returns false if the response is
+ * malformed.
+ */
+static bool ICACHE_FLASH_ATTR receive_data(request_args * req,
+	char * data, size_t len)
+{
+	char * end = data + len;
+	char * p;
+	int n;
+
+	while (data < end && !abort_requested) {
+		switch (req->parse_state) {
+		case PS_PARSING_HEADER:
+			n = parse_header(req, data, end - data);
+			if (n < 0) {
+				os_printf("Invalid response header\n");
+				return false;
+			}
+			data += n;
+			if (req->header_state == HS_DONE) {
+				handle_header(req);
 			}
+			break;
 
-			char *read_end = read_ptr + req->current_chunk_size;
-			if (read_end > buffer_end) {
-				read_end = buffer_end;
+		case PS_PARSING_BODY:
+			p = end;
+			if (req->body_remaining >= 0 && end - data >= req->body_remaining) {
+				p = data + req->body_remaining;
+				req->parse_state = PS_COMPLETE;
 			}
-			size_t read_size = read_end - read_ptr;
-			if (read_size > 0) {
-				/* Null terminate the current block for convenience */
-				char tmp = *read_end;
-				*read_end = '\0';
-				req->user_callback(read_ptr, HTTP_STATUS_BODY, NULL,
-					read_size + 1);
-				*read_end = tmp;
+			deliver_body(req, data, p - data);
+			if (req->body_remaining >= 0) {
+				req->body_remaining -= p - data;
 			}
-			req->current_chunk_size -= read_size;
-			read_ptr += read_size;
-		} while (read_ptr < buffer_end);
+			data = p;
+			break;
 
-		int leftover_size = buffer_end - read_ptr;
-		if (leftover_size < 0) {
-			leftover_size = 0;
+		case PS_PARSING_CHUNK_SIZE:
+		case PS_PARSING_CHUNK_EXT:
+		case PS_PARSING_CHUNK_END:
+			n = parse_chunk_size(req, data, end - data);
+			if (n < 0) {
+				os_printf("Invalid chunk size line\n");
+				return false;
+			}
+			data += n;
+			break;
+
+		case PS_PARSING_CHUNK_DATA:
+			p = end - data > req->current_chunk_size ?
+				data + req->current_chunk_size : end;
+			deliver_body(req, data, p - data);
+			req->current_chunk_size -= p - data;
+			data = p;
+			if (req->current_chunk_size == 0) {
+				req->parse_state = PS_PARSING_CHUNK_END;
+			}
+			break;
+
+		case PS_PARSING_TRAILER:
+			// Trailer fields aren't used, skip them up to the empty line.
+			// header_pos tells whether the current line has any characters.
+			while (data < end && req->parse_state == PS_PARSING_TRAILER) {
+				char c = *data++;
+				if (c == '\n') {
+					if (req->header_pos == 0) {
+						req->parse_state = PS_COMPLETE;
+					}
+					req->header_pos = 0;
+				} else if (c != '\r') {
+					req->header_pos = 1;
+				}
+			}
+			break;
+
+		case PS_COMPLETE:
+			// Anything after the response is ignored.
+			data = end;
+			break;
 		}
-		/* The trailing zero gets copied here */
-		os_memmove(req->buffer, read_ptr, leftover_size + 1);
-		req->buffer_size = leftover_size + 1;
-	} else if (req->parse_state == PS_PARSING_BODY) {
-		req->user_callback(req->buffer, HTTP_STATUS_BODY, NULL,
-			req->buffer_size);
-		req->buffer[0] = '\0';
-		req->buffer_size = 1;
-	}
-
-success:
-	tcp_recved(pcb, len);
+	}
+	return true;
+}
+
+static err_t ICACHE_FLASH_ATTR receive_callback(void * arg,
+	struct tcp_pcb * pcb, struct pbuf * p, err_t err) {
+	http_connection * conn = (http_connection *)arg;
+	request_args * req = conn->queue;
+
+	if (p == NULL) {
+		PRINTF("Disconnected\n");
+		err = close_connection(conn);
+		connection_lost(conn);
+		return err;
+	}
+
+	if (req != NULL) {
+		http_timing * timing = &req->header.timing;
+		timing->last_byte = system_get_time();
+		if (timing->first_byte == 0) {
+			timing->first_byte = timing->last_byte;
+		}
+		// Walk the pbuf chain in place, nothing is copied here.
+		struct pbuf * q;
+		for (q = p; q != NULL && !abort_requested &&
+			req->parse_state != PS_COMPLETE; q = q->next) {
+			timing->bytes += q->len;
+			timing->pbufs++;
+			if (!receive_data(req, q->payload, q->len)) {
+				return abort_connection(conn, p);
+			}
+		}
+		if (abort_requested) {
+			return abort_connection(conn, p);
+		}
+		if (req->parse_state == PS_COMPLETE) {
+			return complete_connection(conn, p);
+		}
+	}
+
+	tcp_recved(pcb, p->tot_len);
 	pbuf_free(p);
 	return ERR_OK;
 }
@@ -384,11 +776,11 @@ success:
 static err_t ICACHE_FLASH_ATTR sent_callback(void * arg, struct tcp_pcb * pcb,
 	uint16_t len)
 {
-	request_args * req = (request_args *)arg;
+	http_connection * conn = (http_connection *)arg;
+	request_args * req = conn->queue;
 
-	if (req->post_data == NULL) {
+	if (req == NULL || req->post_data == NULL) {
 		PRINTF("All sent\n");
-		tcp_sent(pcb, NULL);
 	}
 	else {
 		// The headers were sent, now send the contents.
@@ -396,114 +788,188 @@ static err_t ICACHE_FLASH_ATTR sent_callback(void * arg, struct tcp_pcb * pcb,
 		tcp_write(pcb, (void *)req->post_data, strlen(req->post_data),
 			TCP_WRITE_FLAG_COPY);
 		tcp_output(pcb);
-		os_free(req->post_data);
-		req->post_data = NULL;
+		req->post_data = NULL; // Freed with the request.
 	}
 
 	return ERR_OK;
 }
 
-static err_t ICACHE_FLASH_ATTR connect_callback(void * arg,
-	struct tcp_pcb * pcb, err_t err)
+// Send the request at the head of the queue on the open connection.
+static void ICACHE_FLASH_ATTR send_request(http_connection * conn)
 {
-	PRINTF("Connected\n");
-	request_args * req = (request_args *)arg;
-
-	tcp_sent(pcb, sent_callback);
-	tcp_recv(pcb, receive_callback);
-
+	request_args * req = conn->queue;
 	const char * method = "GET";
 	char post_headers[32] = "";
 
+	abort_requested = false;
 	if (req->post_data != NULL) { // If there is data this is a POST request.
 		method = "POST";
-		os_sprintf(post_headers, "Content-Length: %d\r\n", strlen(req->post_data));
+		os_sprintf(post_headers, "Content-Length: %d\r\n", (int)strlen(req->post_data));
 	}
 
-	char buf[69 + strlen(method) + strlen(req->path) + strlen(req->hostname) +
+	char buf[74 + strlen(method) + strlen(req->path) + strlen(conn->hostname) +
 			 strlen(req->headers) + strlen(post_headers)];
 	int len = os_sprintf(buf,
 						 "%s %s HTTP/1.1\r\n"
 						 "Host: %s:%d\r\n"
-						 "Connection: close\r\n"
+						 "Connection: keep-alive\r\n"
 						 "User-Agent: ESP8266\r\n"
 						 "%s"
 						 "%s"
 						 "\r\n",
-						 method, req->path, req->hostname, req->port, req->headers, post_headers);
-
-	tcp_write(pcb, (void *)buf, len, TCP_WRITE_FLAG_COPY);
-	os_free(req->headers);
-	req->headers = NULL;
+						 method, req->path, conn->hostname, conn->port, req->headers, post_headers);
+
+	tcp_write(conn->pcb, (void *)buf, len, TCP_WRITE_FLAG_COPY);
+	tcp_output(conn->pcb);
+	req->header.timing.dns_start = conn->dns_start;
+	req->header.timing.dns_end = conn->dns_end;
+	req->header.timing.connected = conn->connected;
+	req->header.timing.request_sent = system_get_time();
 	PRINTF("Sending request header\n");
+}
+
+static err_t ICACHE_FLASH_ATTR connect_callback(void * arg,
+	struct tcp_pcb * pcb, err_t err)
+{
+	PRINTF("Connected\n");
+	http_connection * conn = (http_connection *)arg;
+
+	conn->connected = system_get_time();
+	tcp_sent(pcb, sent_callback);
+	tcp_recv(pcb, receive_callback);
+
+	if (conn->queue == NULL) {
+		// Nothing was queued.
+		err = close_connection(conn);
+		free_connection(conn);
+		return err;
+	}
+	send_request(conn);
 	return ERR_OK;
 }
 
 static void ICACHE_FLASH_ATTR error_callback(void *arg, sint8 errType)
 {
 	PRINTF("Disconnected with error\n");
-	disconnect_callback(arg);
+	http_connection * conn = (http_connection *)arg;
+
+	conn->pcb = NULL; // Already freed by lwIP.
+	connection_lost(conn);
+}
+
+// Connect to the resolved address. Returns false if that can't be tried.
+static bool ICACHE_FLASH_ATTR start_connection(http_connection * conn)
+{
+	struct tcp_pcb * pcb = tcp_new();
+	if (pcb == NULL) {
+		os_printf("Error allocating pcb\n");
+		return false;
+	}
+	tcp_arg(pcb, (void *)conn);
+	tcp_err(pcb, error_callback);
+	if (tcp_connect(pcb, &conn->addr, conn->port, connect_callback) != ERR_OK) {
+		os_printf("Error connecting\n");
+		tcp_abort(pcb);
+		return false;
+	}
+	conn->pcb = pcb;
+	conn->reused = false;
+	return true;
 }
 
 static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * addr, void * arg)
 {
-	request_args * req = (request_args *)arg;
+	http_connection * conn = (http_connection *)arg;
 
 	if (addr == NULL) {
 		os_printf("DNS failed for %s\n", hostname);
-		if (req->user_callback != NULL) {
-			req->user_callback("", -1, "", 0);
-		}
-		os_free(req->buffer);
-		os_free(req->post_data);
-		os_free(req->headers);
-		os_free(req->path);
-		os_free(req->hostname);
-		os_free(req);
+		fail_connection(conn);
 	}
 	else {
 		PRINTF("DNS found %s " IPSTR "\n", hostname, IP2STR(addr));
-
-		struct tcp_pcb * pcb = tcp_new();
-		if (pcb == NULL) {
-			os_printf("Error allocating pcb\n");
+		conn->dns_end = system_get_time();
+		conn->addr = *addr;
+		if (!start_connection(conn)) {
+			fail_connection(conn);
 		}
-		tcp_arg(pcb, (void *)req);
-
-		tcp_err(pcb, error_callback);
-		tcp_connect(pcb, addr, req->port, connect_callback);
 	}
 }
 
-static void ICACHE_FLASH_ATTR do_http_raw_request(const char * hostname, int port, bool secure, const char * path, const char * post_data, const char * headers, http_callback user_callback)
+http_connection * ICACHE_FLASH_ATTR http_connection_open(const char * hostname, int port, bool secure)
 {
 	PRINTF("DNS request\n");
 
-	request_args * req = (request_args *)os_malloc(sizeof(request_args));
-	req->hostname = esp_strdup(hostname);
-	req->path = esp_strdup(path);
-	req->port = port;
-	req->secure = secure;
-	req->headers = esp_strdup(headers);
-	req->post_data = esp_strdup(post_data);
-	req->buffer_size = 1;
-	req->buffer_allocated_size = 1;
-	req->buffer = (char *)os_malloc(1);
-	req->buffer[0] = '\0'; // Empty string.
-	req->user_callback = user_callback;
-	req->parse_state = PS_PARSING_HEADER;
-	req->current_chunk_size = 0;
+	http_connection * conn = (http_connection *)os_zalloc(
+		sizeof(http_connection) + arena_size(hostname));
+	if (conn == NULL) {
+		os_printf("http_connection_open: malloc error\n");
+		return NULL;
+	}
+	char * arena = (char *)(conn + 1);
+	conn->hostname = arena_strdup(&arena, hostname);
+	conn->port = port;
+	conn->secure = secure;
 
-	struct ip_addr addr;
-	err_t error = dns_gethostbyname(hostname, &addr, dns_callback, req);
+	conn->dns_start = system_get_time();
+	conn->dns_end = conn->dns_start; // Unless the answer isn't in the cache.
+	err_t error = dns_cache_gethostbyname(hostname, &conn->addr, dns_callback, conn);
 
 	if (error == ERR_INPROGRESS) {
 		PRINTF("DNS pending\n");
 	}
-	else if (error == ERR_OK) {
-		// Already in the local names table (or hostname was an IP address), execute the callback ourselves.
-		dns_callback(hostname, &addr, req);
+	else if (error != ERR_OK || !start_connection(conn)) {
+		// Already in the DNS cache (or hostname was an IP address) unless
+		// there was an error.
+		free_connection(conn);
+		return NULL;
 	}
+	return conn;
+}
+
+void ICACHE_FLASH_ATTR http_connection_request(http_connection * conn, const char * path, const char * post_data, const char * headers, http_callback user_callback)
+{
+	request_args * req = (request_args *)os_zalloc(sizeof(request_args) +
+		arena_size(path) + arena_size(headers) + arena_size(post_data));
+	if (req == NULL) {
+		os_printf("http_connection_request: malloc error\n");
+		if (user_callback != NULL) {
+			user_callback(NULL, HTTP_STATUS_GENERIC_ERROR, NULL, 0);
+		}
+		return;
+	}
+	char * arena = (char *)(req + 1);
+	req->path = arena_strdup(&arena, path);
+	req->headers = arena_strdup(&arena, headers);
+	req->post_data = arena_strdup(&arena, post_data);
+	req->post = post_data != NULL;
+	req->user_callback = user_callback;
+	req->parse_state = PS_PARSING_HEADER;
+	req->current_chunk_size = 0;
+	req->body_remaining = -1;
+	req->header.content_length = -1;
+	req->header_state = HS_VERSION;
+	req->header_pos = 0;
+
+	// The connection is being set up or busy with the head of the queue,
+	// the request is sent when its turn comes.
+	request_args ** tail = &conn->queue;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+	*tail = req;
+}
+
+static void ICACHE_FLASH_ATTR do_http_raw_request(const char * hostname, int port, bool secure, const char * path, const char * post_data, const char * headers, http_callback user_callback)
+{
+	http_connection * conn = http_connection_open(hostname, port, secure);
+
+	if (conn == NULL) {
+		if (user_callback != NULL) {
+			user_callback(NULL, HTTP_STATUS_GENERIC_ERROR, NULL, 0);
+		}
+		return;
+	}
+	http_connection_request(conn, path, post_data, headers, user_callback);
 }
 
 void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * path, const char * post_data, const char * headers, http_callback user_callback) {
@@ -583,16 +1049,23 @@ void ICACHE_FLASH_ATTR http_get(const char * url, const char * headers, http_cal
 	do_http_post(url, NULL, headers, user_callback);
 }
 
-void ICACHE_FLASH_ATTR http_callback_example(char * response_body, int http_status, char * response_headers, int body_size)
+void ICACHE_FLASH_ATTR http_abort(void)
+{
+	abort_requested = true;
+}
+
+void ICACHE_FLASH_ATTR http_callback_example(char * response_body, int http_status, const http_header * response_header, int body_size)
 {
-	if (http_status > 0 && response_headers != NULL) {
-		os_printf("Received HTTP response with status %d and headers:\n%s\n",
-			http_status, response_headers);
+	if (http_status > 0 && response_header != NULL) {
+		os_printf("Received HTTP response with status %d, length %d%s\n",
+			http_status, response_header->content_length,
+			response_header->chunked ? ", chunked" : "");
 	} else if (http_status == HTTP_STATUS_BODY) {
-		os_printf("Received a part of the response body:\n%s\n",
-			response_body);
+		os_printf("Received a part of the response body:\n%.*s\n",
+			body_size, response_body);
 	} else if (http_status == HTTP_STATUS_DISCONNECT) {
-		os_printf("The response has ended.\n");
+		os_printf("The response has ended, %u bytes received.\n",
+			response_header->timing.bytes);
 	}
 }
 
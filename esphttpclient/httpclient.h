@@ -13,19 +13,61 @@
 #include <espmissingincludes.h> // This can remove some warnings depending on your project setup. It is safe to remove this line.
 
 #define HTTP_STATUS_GENERIC_ERROR  -1   // In case of TCP or DNS error the callback is called with this status.
-#define BUFFER_SIZE_MAX            5000 // Size of http responses that will cause an error.
 
 #define HTTP_STATUS_BODY           -2
 #define HTTP_STATUS_DISCONNECT     -3
 
 /*
- * "full_response" is a string containing all response headers and the response body.
- * "response_body and "http_status" are extracted from "full_response" for convenience.
+ * When each phase of a request ended, as system_get_time() microseconds, or
+ * 0 if the request didn't get that far. The response phases are the arrival
+ * times of the pbufs they happened in. The DNS and connect times are those
+ * of the connection the request was sent on, which may have carried earlier
+ * requests too.
+ */
+typedef struct {
+	uint32_t dns_start;
+	uint32_t dns_end;
+	uint32_t connected;
+	uint32_t request_sent;     // Handed to TCP
+	uint32_t first_byte;       // Of the response
+	uint32_t header_done;
+	uint32_t first_body_byte;
+	uint32_t last_byte;
+	uint32_t bytes;            // Received for the response, header included
+	uint32_t pbufs;            // The bytes arrived in
+} http_timing;
+
+/*
+ * The response header fields that the client parses. Field names are matched
+ * case-insensitively and longer values are truncated.
+ */
+typedef struct {
+	int status;                // HTTP status code
+	int content_length;        // -1 without a valid Content-Length
+	bool chunked;              // Transfer-Encoding ends with "chunked"
+	bool keep_alive;           // The server keeps the connection open
+	char date[32];             // Empty strings if the field wasn't present
+	char etag[48];
+	char content_encoding[16];
+	char last_modified[32];
+	http_timing timing;        // Filled in as the request goes on
+} http_header;
+
+/*
+ * The callback is first called with the status code and the parsed
+ * "response_header", then with HTTP_STATUS_BODY for each part of the body.
+ * The parts point into the received pbuf, aren't null-terminated and
+ * "body_size" is their length in bytes. HTTP_STATUS_DISCONNECT follows as
+ * soon as the response is complete according to its Content-Length or last
+ * chunk, the client then closes the connection itself unless another request
+ * is queued on it. Otherwise it comes when the server closes the connection
+ * or on an error. With HTTP_STATUS_DISCONNECT "response_header" points to the
+ * fields received so far, its timing tells where the time went.
  *
  * A successful request corresponds to an HTTP status code of 200 (OK).
  * More info at http://en.wikipedia.org/wiki/List_of_HTTP_status_codes
  */
-typedef void (* http_callback)(char * response_body, int http_status, char * response_headers, int body_size);
+typedef void (* http_callback)(char * response_body, int http_status, const http_header * response_header, int body_size);
 
 /*
  * Download a web page from its URL.
@@ -47,9 +89,39 @@ void ICACHE_FLASH_ATTR http_post(const char * url, const char * post_data, const
  */
 void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * path, const char * post_data, const char * headers, http_callback user_callback);
 
+/*
+ * A keep-alive connection to one host that runs a queue of requests one at
+ * a time. Queue at least one request right after opening it. More can be
+ * queued later from the callbacks of its requests. Each request gets the
+ * same callbacks as with http_raw_request and its HTTP_STATUS_DISCONNECT
+ * marks the end of its response. The next request then goes out on the
+ * same connection, or on a new one if the server closed it. Once the queue
+ * is empty, the connection is closed and the object freed.
+ *
+ * Returns NULL if the host can't be resolved right away or on a memory
+ * error. A DNS failure later fails each queued request with
+ * HTTP_STATUS_GENERIC_ERROR.
+ * Try:
+ * http_connection * conn = http_connection_open("example.com", 80, false);
+ * http_connection_request(conn, "/a", NULL, "", http_callback_example);
+ * http_connection_request(conn, "/b", NULL, "", http_callback_example);
+ */
+typedef struct http_connection http_connection;
+
+http_connection * ICACHE_FLASH_ATTR http_connection_open(const char * hostname, int port, bool secure);
+void ICACHE_FLASH_ATTR http_connection_request(http_connection * conn, const char * path, const char * post_data, const char * headers, http_callback user_callback);
+
+/*
+ * Abort the request whose callback is currently running. The connection is
+ * reset right away and the callback is then called once more with
+ * HTTP_STATUS_DISCONNECT. Requests queued behind it continue on a new
+ * connection. Only valid from within an http_callback.
+ */
+void ICACHE_FLASH_ATTR http_abort(void);
+
 /*
  * Output on the UART.
  */
-void ICACHE_FLASH_ATTR http_callback_example(char * response_body, int http_status, char * response_headers, int body_size);
+void ICACHE_FLASH_ATTR http_callback_example(char * response_body, int http_status, const http_header * response_header, int body_size);
 
 #endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <c_types.h>
+#include "lwip/dns.h"
+
+// Resolved addresses kept in RTC memory across deep sleep. A cached address
+// is used right away. After DNS_CACHE_TTL it is still used, but refreshed
+// by a query in the background, so a DNS failure leaves the stale address.
+
+#define DNS_CACHE_ENTRIES 4
+#define DNS_CACHE_TTL (60 * 60)     // Seconds
+#define DNS_CACHE_SLOTS (1 + 3 * DNS_CACHE_ENTRIES)
+
+// Loads the cache from the given RTC slot on, without it every lookup goes
+// to DNS. Uses rtc_clock_us(), so rtc_clock_init() has to be called first.
+void dns_cache_init(uint8_t slot);
+
+// Same as dns_gethostbyname(), answers from the cache when it can
+err_t dns_cache_gethostbyname(const char *hostname, ip_addr_t *addr,
+    dns_found_callback found, void *callback_arg);
+
+// Drops the cached address of the host, for when it turned out not to work.
+// The next lookup goes to DNS.
+void dns_cache_forget(const char *hostname);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <time.h>
+#include <c_types.h>
+
+// When to fetch the forecasts next. The next fetch is planned for when the
+// upstream update is due after the last change that was seen. If it's late
+// the fetches back off, and failed fetches back off on their own.
+
+// All below are milliseconds
+#define DATA_FETCH_INTERVAL (5*60000)
+// Failed fetches double the interval up to this many times, as do fetches
+// that find an overdue update still missing
+#define DATA_FETCH_MAX_BACKOFF 3
+// Longest sleep between fetches, system_deep_sleep() is limited to about
+// 71 minutes
+#define DATA_FETCH_MAX_INTERVAL (60*60000)
+
+// Seconds between the upstream forecast updates
+#define FORECAST_UPDATE_INTERVAL (3*3600)
+// Scheduled fetches are delayed by up to this many seconds depending on the
+// chip, so that devices don't all ask at once
+#define FETCH_JITTER (5*60)
+
+typedef enum {
+    FETCH_FAILED,
+    FETCH_UNCHANGED,    // Same forecasts as the stored ones
+    FETCH_UPDATED
+} fetch_result_t;
+
+// Kept in RTC memory. The times are seconds since the epoch, 0 if unknown.
+typedef struct {
+    uint32_t magic;
+    uint32_t last_change;       // When a fetch last got new forecasts
+    uint32_t next_fetch;
+    uint32_t misses;            // Unchanged fetches since an update was due
+} fetch_schedule_t;
+
+// Milliseconds to sleep after a fetch with the given result, now 0 if the
+// time isn't known. failures counts the failed fetches in a row including
+// this one. stale is when the stored forecasts start to be out of date, 0
+// if there are none, and jitter the seconds of delay of this device, below
+// FETCH_JITTER. The schedule is updated unless the fetch failed.
+uint32_t fetch_schedule_next(fetch_schedule_t *schedule, fetch_result_t result,
+    uint32_t failures, time_t now, time_t stale, uint32_t jitter);
+
+// Milliseconds left until the planned fetch, DATA_FETCH_INTERVAL if there
+// is no plan that can be kept
+uint32_t fetch_schedule_remaining(const fetch_schedule_t *schedule, time_t now);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <c_types.h>
+
+// Streaming decoder for gzip and deflate content encodings. The compressed
+// data can be fed in pieces of any size and the decompressed data comes out
+// through a callback in runs, nothing but the window is buffered.
+
+// Back references can only reach as far as the window. Servers compress with
+// a 32 KB window unless told otherwise, so a smaller one only decodes
+// responses whose references happen to stay within it.
+#define INFLATE_WINDOW_BITS_MIN 8
+#define INFLATE_WINDOW_BITS_MAX 15
+#define INFLATE_WINDOW_SIZE(bits) (1U << (bits))
+
+typedef enum {
+    INFLATE_FORMAT_RAW,     // Bare deflate data
+    INFLATE_FORMAT_ZLIB,    // Content-Encoding: deflate, the zlib wrapper
+                            // is optional since some servers leave it out
+    INFLATE_FORMAT_GZIP     // Content-Encoding: gzip
+} inflate_format_t;
+
+typedef enum {
+    INFLATE_ERROR = -1,     // Corrupt data or a reference beyond the window
+    INFLATE_MORE = 0,       // Feed more data
+    INFLATE_DONE = 1,       // The stream ended and its checksum matched
+    INFLATE_STOPPED = 2     // The output callback asked to stop
+} inflate_result_t;
+
+// Gets the decompressed data, returns false to stop decoding
+typedef bool (*inflate_output_cb)(const char *data, size_t len, void *arg);
+
+typedef struct {
+    int state;
+    inflate_format_t format;
+    bool final;             // Current block is the last one
+    bool stopped;
+    uint8_t flags;          // Of the gzip header
+    uint32_t bit_buffer;
+    unsigned bit_count;
+    unsigned count;         // Meaning depends on the state
+    unsigned length;        // Of a stored block or a match
+    unsigned lit_count;     // Code lengths of a dynamic block
+    unsigned length_count;
+    uint32_t check;         // CRC-32 or Adler-32 of the output
+    uint32_t trailer;
+    uint32_t total_out;
+    uint8_t *window;
+    size_t window_size;
+    size_t window_pos;
+    size_t flush_pos;       // Start of the output not yet passed on
+    inflate_output_cb output;
+    void *arg;
+    // Canonical Huffman codes as counts of each code length and the symbols
+    // in code order. The code length code of a dynamic block lives in the
+    // distance code.
+    uint16_t lit_counts[16];
+    uint16_t lit_symbols[288];
+    uint16_t dist_counts[16];
+    uint16_t dist_symbols[32];
+    uint8_t lengths[288 + 32];
+} inflate_t;
+
+// The window must hold INFLATE_WINDOW_SIZE(window_bits) bytes
+void inflate_init(inflate_t *inf, inflate_format_t format, uint8_t *window,
+    unsigned window_bits, inflate_output_cb output, void *arg);
+inflate_result_t inflate_stream(inflate_t *inf, const char *data, size_t len);
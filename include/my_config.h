@@ -1,6 +1,10 @@
 /* Use the search at http://openweathermap.org/city to find this. The ID will be in the browser address bar. */
 const char OWMAP_CITY_ID[] = "655195";
 
+/* The units and lang parameters of the forecast query, see https://openweathermap.org/forecast5. Leave empty to use the API defaults. */
+const char OWMAP_UNITS[] = "metric";
+const char OWMAP_LANG[] = "";
+
 const int TIMEZONE_OFFSET = 2;
 
 const char *WEEKDAYS[] = { "su", "ma", "ti", "ke", "to", "pe", "la" };
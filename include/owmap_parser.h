@@ -7,6 +7,12 @@
 
 #define FORECAST_MAX_COUNT 8
 
+// The forecast document nests 5 levels deep: {"list":[{"weather":[{
+#define WEATHER_JSON_MAX_DEPTH 6
+// Icon strings such as "10d" and keys up to the buffer size are buffered,
+// numbers aren't. The filter keys must fit, the longest is "weather".
+#define WEATHER_JSON_BUFFER_SIZE 16
+
 typedef enum {
     ICON_NONE = 0,
     CLEAR_SKY = 1,
@@ -26,21 +32,31 @@ typedef struct {
     weather_icon_t icon;
 } weather_t;
 
+typedef enum {
+    WEATHER_PARSE_ERROR = -1,   // Invalid JSON or an API error response
+    WEATHER_PARSE_MORE = 0,     // Feed more data
+    WEATHER_PARSE_DONE = 1      // All forecasts found, the rest isn't needed
+} weather_parse_result_t;
+
 typedef struct {
-    char current_key[64];
-    int array_level;
-    int object_level;
-    bool in_list;
-    long dt;
-    int temp;
-    weather_icon_t icon;
+    int depth;              // Nesting level of the containers reported
+    bool in_record;         // current is being filled
+    weather_t current;      // Forecast being filled
     weather_t forecasts[FORECAST_MAX_COUNT];
     int forecast_count;
+    bool done;
+    bool error;
     jsmn_stream_parser json_parser;
+    char json_buffer[WEATHER_JSON_BUFFER_SIZE];
+    unsigned char json_type_stack[JSMN_STREAM_TYPE_STACK_SIZE(WEATHER_JSON_MAX_DEPTH)];
+    jsmn_stream_level_t json_levels[WEATHER_JSON_MAX_DEPTH];
 } weather_parser_t;
 
 void weather_parser_init(weather_parser_t *parser);
-void weather_stream_parse(weather_parser_t *parser, char c);
+weather_parse_result_t weather_stream_parse(weather_parser_t *parser,
+    const char *buf, size_t len);
+// Whether a whole response was parsed into forecasts that can be stored
+bool weather_parse_complete(const weather_parser_t *parser);
 
 unsigned char *get_weather_icon_bitmap(weather_icon_t icon);
 
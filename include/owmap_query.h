@@ -0,0 +1,27 @@
+#pragma once
+
+#include <time.h>
+#include <c_types.h>
+
+// The forecast request, asking for no more forecasts than the display needs
+
+#define OWMAP_HOST "api.openweathermap.org"
+
+// Seconds between forecasts, they are for the hours divisible by 3 UTC
+#define FORECAST_INTERVAL (3*3600)
+// Forecasts shown, picked from those between DAYTIME_START and DAYTIME_END
+#define DAYTIME_FORECASTS 3
+#define DAYTIME_START 9
+#define DAYTIME_END 18
+
+bool is_daytime(time_t time);
+
+// Number of forecasts to ask for so that DAYTIME_FORECASTS of them can be
+// shown whether the list starts with the forecast in progress or the next
+// one, FORECAST_MAX_COUNT if the time isn't known
+int forecast_count_needed(time_t now);
+
+// The URL of the forecast query, units and lang are left out when empty.
+// Returns false if it didn't fit.
+bool build_owmap_query(char *buf, size_t size, const char *city_id,
+    const char *api_key, int count, const char *units, const char *lang);
@@ -0,0 +1,27 @@
+// Generated by tools/gen_owmap_schema.py from owmap_schema.txt, do not edit
+#pragma once
+
+#include "owmap_parser.h"
+
+// Containers enclosing a forecast: list[*]
+#define OWMAP_RECORD_DEPTH 2
+// Filter path of a field inside the record
+#define OWMAP_RECORD_FIELD 1
+#define OWMAP_FIELD_COUNT 4
+
+typedef enum {
+    OWMAP_CONVERT_TIME = 0,
+    OWMAP_CONVERT_INT = 1,
+    OWMAP_CONVERT_PERCENT = 2,
+    OWMAP_CONVERT_ICON = 3,
+    OWMAP_CONVERT_STATUS = 4
+} owmap_conversion_t;
+
+typedef struct {
+    unsigned char offset;       // Offset of the member in weather_t
+    unsigned char conversion;   // owmap_conversion_t
+} owmap_field_t;
+
+// Filter path i is the path of field i
+extern const jsmn_stream_filter_t owmap_filter;
+extern const owmap_field_t owmap_fields[OWMAP_FIELD_COUNT];
@@ -1,6 +1,22 @@
 #pragma once
 
 #include <time.h>
+#include <c_types.h>
+
+// 32-bit FNV-1a, start with HASH_INIT and feed the data in any pieces
+#define HASH_INIT 2166136261UL
+uint32_t hash_update(uint32_t hash, const void *data, size_t len);
+
+// Microseconds since power up, counted across deep sleep in RTC memory from
+// the slot given to rtc_clock_init() on. The RTC tick counter wraps after
+// about 7 hours, the clock has to be read at least that often.
+#define RTC_CLOCK_SLOTS 4
+void rtc_clock_init(uint8_t slot);
+uint64_t rtc_clock_us(void);
+
+// Seconds since the epoch from an HTTP Date header such as
+// "Sun, 06 Nov 1994 08:49:37 GMT", 0 if it isn't in that format
+time_t parse_http_date(const char *date);
 
 void dns_resolve(const char *hostname, void (*dns_callback)(uint8_t *ip));
 
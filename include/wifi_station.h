@@ -25,6 +25,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // The callback gets an argument: whether connection succeeded or not
 typedef void (*station_connect_cb)(bool connected);
 
+// The access point and address of the last connection can be kept in RTC
+// memory across deep sleep. The next connection then joins the access point
+// on its channel without a scan and reuses the address without DHCP, and
+// falls back to both if that doesn't work.
+#define WIFI_STATION_CACHE_SLOTS 8
+
+// Loads the settings from the given RTC slot on, without it every
+// connection scans and uses DHCP
+void wifi_station_cache_init(uint8_t slot);
+// Drops the settings, for when the address turned out not to work
+void wifi_station_forget(void);
+
 void wifi_station_init(const char *ssid, const char *password,
     station_connect_cb user_connect_cb, uint32_t timeout_ms);
 
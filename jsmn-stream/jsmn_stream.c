@@ -6,219 +6,805 @@
 #include "jsmn_stream.h"
 
 #include <stdbool.h>
+#include <string.h>
 
 #define JSMN_STREAM_CALLBACK(f, ...) if ((f) != NULL) { (f)(__VA_ARGS__); }
 
-static bool jsmn_stream_stack_push(jsmn_stream_parser *parser, jsmn_streamtype_t type) {
-	if (parser->stack_height >= JSMN_STREAM_MAX_DEPTH) {
+/*
+ * Filter match state of a value: either a set of path bits that may still
+ * match below it, or JSMN_STREAM_MATCH_FULL together with the index of the
+ * path that matched it (then everything below it matches too). Zero means
+ * nothing can match and the value is skipped.
+ */
+#define JSMN_STREAM_MATCH_FULL 0x80
+
+/* Position inside a number: -?int(.frac)?([eE][+-]?exp)? */
+enum {
+	JSMN_STREAM_NUMBER_START = 0,
+	JSMN_STREAM_NUMBER_INT = 1,
+	JSMN_STREAM_NUMBER_FRAC = 2,
+	JSMN_STREAM_NUMBER_EXP_START = 3,
+	JSMN_STREAM_NUMBER_EXP_SIGN = 4,
+	JSMN_STREAM_NUMBER_EXP = 5
+};
+
+/* Whether the mantissa can take digit d without exceeding INT32_MAX */
+#define JSMN_STREAM_MANTISSA_FITS(m, d) ((m) < INT32_MAX / 10 || \
+	((m) == INT32_MAX / 10 && (d) <= INT32_MAX % 10))
+/* Explicit exponents are clamped here, far beyond any int32 value */
+#define JSMN_STREAM_EXP_MAX 9999
+
+/* 32-bit FNV-1a, computed incrementally over the key bytes */
+#define JSMN_STREAM_HASH_INIT 2166136261UL
+#define JSMN_STREAM_HASH_STEP(h, c) (((h) ^ (unsigned char)(c)) * 16777619UL)
+
+static uint32_t jsmn_stream_hash(const char *s, size_t len) {
+	uint32_t h = JSMN_STREAM_HASH_INIT;
+	while (len-- > 0) {
+		h = JSMN_STREAM_HASH_STEP(h, *s++);
+	}
+	return h;
+}
+
+/*
+ * The type stack has 2 bits per container: whether it is an array and, for
+ * objects, whether a key has been read and its value is pending.
+ */
+#define JSMN_STREAM_TYPE_ARRAY 1
+#define JSMN_STREAM_TYPE_KEY 2
+
+static inline unsigned char jsmn_stream_type_get(const jsmn_stream_parser *parser,
+	size_t level) {
+	return (parser->type_stack[level >> 2] >> ((level & 3) << 1)) & 3;
+}
+
+static inline void jsmn_stream_type_set(jsmn_stream_parser *parser,
+	size_t level, unsigned char bits) {
+	unsigned char shift = (level & 3) << 1;
+	parser->type_stack[level >> 2] =
+		(parser->type_stack[level >> 2] & ~(3 << shift)) | (bits << shift);
+}
+
+static inline bool jsmn_stream_stack_push(jsmn_stream_parser *parser,
+	jsmn_streamtype_t type, unsigned char match) {
+	if (type == JSMN_STREAM_KEY) {
+		jsmn_stream_type_set(parser, parser->level - 1, JSMN_STREAM_TYPE_KEY);
+		return true;
+	}
+	if (parser->level >= parser->max_depth) {
 		return false;
 	}
-	parser->type_stack[parser->stack_height++] = type;
+	jsmn_stream_type_set(parser, parser->level,
+		type == JSMN_STREAM_ARRAY ? JSMN_STREAM_TYPE_ARRAY : 0);
+	if (parser->levels != NULL) {
+		parser->levels[parser->level].match = match;
+		parser->levels[parser->level].index = 0;
+	}
+	parser->level++;
 	return true;
 }
 
-static jsmn_streamtype_t jsmn_stream_stack_pop(jsmn_stream_parser *parser) {
-	if (parser->stack_height == 0) {
+static inline jsmn_streamtype_t jsmn_stream_stack_top(const jsmn_stream_parser *parser) {
+	if (parser->level == 0) {
 		return JSMN_STREAM_UNDEFINED;
 	}
-	return parser->type_stack[parser->stack_height--];
+	switch (jsmn_stream_type_get(parser, parser->level - 1)) {
+		case JSMN_STREAM_TYPE_KEY:
+			return JSMN_STREAM_KEY;
+		case JSMN_STREAM_TYPE_ARRAY:
+			return JSMN_STREAM_ARRAY;
+		default:
+			return JSMN_STREAM_OBJECT;
+	}
 }
 
-static jsmn_streamtype_t jsmn_stream_stack_top(jsmn_stream_parser *parser) {
-	if (parser->stack_height == 0) {
-		return JSMN_STREAM_UNDEFINED;
+static inline void jsmn_stream_stack_pop(jsmn_stream_parser *parser) {
+	if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
+		jsmn_stream_type_set(parser, parser->level - 1, 0);
+	} else if (parser->level > 0) {
+		parser->level--;
 	}
-	return parser->type_stack[parser->stack_height - 1];
 }
 
+static inline bool jsmn_stream_is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool jsmn_stream_is_hex(char c) {
+	return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
+		(c >= 'a' && c <= 'f');
+}
+
+static inline bool jsmn_stream_is_delimiter(char c) {
+	return jsmn_stream_is_space(c) || c == ',' || c == ']' || c == '}';
+}
+
+/* Bytes of a word that equal b have their top bit set, others are cleared */
+#define JSMN_STREAM_WORD_ONES 0x01010101UL
+#define JSMN_STREAM_WORD_HIGHS 0x80808080UL
+#define JSMN_STREAM_WORD_HAS_BYTE(w, b) \
+	((((w) ^ (JSMN_STREAM_WORD_ONES * (b))) - JSMN_STREAM_WORD_ONES) & \
+	~((w) ^ (JSMN_STREAM_WORD_ONES * (b))) & JSMN_STREAM_WORD_HIGHS)
+
 /**
- * Fills next available token with JSON primitive.
+ * Returns the first quote or backslash in [p, end), or end. The string body
+ * is read a 32-bit word at a time unless JSMN_STREAM_SWAR is 0. Loads are aligned because the ESP8266
+ * faults on unaligned ones and buffers such as pbuf payloads may start at
+ * any address.
  */
-static int jsmn_stream_parse_primitive(jsmn_stream_parser *parser, char cin) {
-	/* Leave space for the terminating null character */
-	if (parser->buffer_size == JSMN_STREAM_BUFFER_SIZE - 1) {
-		return JSMN_STREAM_ERROR_NOMEM;
-	}
-	parser->buffer[parser->buffer_size++] = cin;
-	size_t len = parser->buffer_size;
-	const char *js = parser->buffer;
-	for (int pos = 0; pos < len && js[pos] != '\0'; pos++) {
-		switch (js[pos]) {
-			case '\t' : case '\r' : case '\n' : case ' ' :
-			case ','  : case ']'  : case '}' :
-				goto found;
+static const char *jsmn_stream_scan_string(const char *p, const char *end) {
+#if JSMN_STREAM_SWAR
+	while (((uintptr_t)p & 3) != 0) {
+		if (p == end || *p == '\"' || *p == '\\') {
+			return p;
 		}
-		if (js[pos] < 32 || js[pos] >= 127) {
-			return JSMN_STREAM_ERROR_INVAL;
+		p++;
+	}
+	while (end - p >= 4) {
+		uint32_t w;
+		memcpy(&w, __builtin_assume_aligned(p, 4), sizeof(w));
+		if (JSMN_STREAM_WORD_HAS_BYTE(w, '\"') |
+			JSMN_STREAM_WORD_HAS_BYTE(w, '\\')) {
+			break;
 		}
+		p += 4;
 	}
-	/* In strict mode primitive must be followed by a comma/object/array */
-	return JSMN_STREAM_ERROR_PART;
-
-found:
-	parser->buffer[len - 1] = '\0';
-	JSMN_STREAM_CALLBACK(parser->callbacks.primitive_callback, js, len - 1,
-		parser->user_arg);
-	parser->buffer_size = 0;
-	parser->state = JSMN_STREAM_PARSING;
-	return 0;
+#endif
+	while (p != end && *p != '\"' && *p != '\\') {
+		p++;
+	}
+	return p;
 }
 
 /**
- * Fills next token with JSON string.
+ * Match state of a child of a container whose match state is given. The
+ * child is identified either by its key (is_key) or by its array index;
+ * level is the path segment position of the child. The hash rules out most
+ * keys, the text is compared only when it and the length agree.
  */
-static int jsmn_stream_parse_string(jsmn_stream_parser *parser, char cin) {
-	/* Leave space for the terminating null character */
-	if (parser->buffer_size == JSMN_STREAM_BUFFER_SIZE - 1) {
-		return JSMN_STREAM_ERROR_NOMEM;
+static unsigned char jsmn_stream_filter_step(const jsmn_stream_filter_t *filter,
+	unsigned char match, size_t level, bool is_key, uint32_t key_hash,
+	const char *key, size_t key_length, unsigned char index) {
+	unsigned char child_match = 0;
+	unsigned char i;
+
+	if (match & JSMN_STREAM_MATCH_FULL) {
+		return match;
 	}
-	parser->buffer[parser->buffer_size++] = cin;
-	size_t len = parser->buffer_size;
-	const char *js = parser->buffer;
-	for (int pos = 0; pos < len; pos++) {
-		char c = js[pos];
-
-		/* Quote: end of string */
-		if (c == '\"') {
-			parser->buffer[len - 1] = '\0';
-			JSMN_STREAM_CALLBACK(jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY ?
-				parser->callbacks.string_callback : parser->callbacks.object_key_callback,
-				js, len - 1, parser->user_arg);
-			parser->buffer_size = 0;
-			parser->state = JSMN_STREAM_PARSING;
-			return 0;
+	for (i = 0; i < filter->path_count; i++) {
+		if (!(match & (1 << i))) continue;
+
+		const jsmn_stream_path_segment_t *seg =
+			&filter->segments[filter->path_start[i] + level];
+		switch (seg->type) {
+			case JSMN_STREAM_SEGMENT_KEY:
+				if (!is_key || seg->key_hash != key_hash ||
+					seg->key_length != key_length ||
+					memcmp(seg->key, key, key_length) != 0) continue;
+				break;
+			case JSMN_STREAM_SEGMENT_ANY_KEY:
+				if (!is_key) continue;
+				break;
+			case JSMN_STREAM_SEGMENT_INDEX:
+				if (is_key || seg->index != index) continue;
+				break;
+			case JSMN_STREAM_SEGMENT_ANY_INDEX:
+				if (is_key) continue;
+				break;
+		}
+		if (filter->path_start[i] + level + 1 == filter->path_start[i + 1]) {
+			return JSMN_STREAM_MATCH_FULL | i;
 		}
+		child_match |= 1 << i;
+	}
+	return child_match;
+}
 
-		/* Backslash: Quoted symbol expected */
-		if (c == '\\' && pos + 1 < len) {
-			int i;
-			pos++;
-			switch (js[pos]) {
-				/* Allowed escaped symbols */
-				case '\"': case '/' : case '\\' : case 'b' :
-				case 'f' : case 'r' : case 'n'  : case 't' :
-					break;
-				/* Allows escaped symbol \uXXXX */
-				case 'u':
-					pos++;
-					for(i = 0; i < 4 && pos < len && js[pos] != '\0'; i++) {
-						/* If it isn't a hex character we have an error */
-						if(!((js[pos] >= 48 && js[pos] <= 57) || /* 0-9 */
-									(js[pos] >= 65 && js[pos] <= 70) || /* A-F */
-									(js[pos] >= 97 && js[pos] <= 102))) { /* a-f */
-							return JSMN_STREAM_ERROR_INVAL;
-						}
-						pos++;
-					}
-					pos--;
-					break;
-				/* Unexpected symbol */
-				default:
-					return JSMN_STREAM_ERROR_INVAL;
+/**
+ * Compute the match state of a value that is about to start.
+ */
+static unsigned char jsmn_stream_value_start(jsmn_stream_parser *parser) {
+	const jsmn_stream_filter_t *filter = parser->filter;
+	unsigned char match;
+
+	if (filter == NULL) {
+		match = JSMN_STREAM_MATCH_FULL;
+	} else if (parser->level == 0) {
+		/* Root value: every path may match, an empty path matches it all */
+		unsigned char i;
+		match = 0;
+		for (i = 0; i < filter->path_count; i++) {
+			if (filter->path_start[i] == filter->path_start[i + 1]) {
+				match = JSMN_STREAM_MATCH_FULL | i;
+				break;
 			}
+			match |= 1 << i;
+		}
+	} else if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
+		/* The key was matched when it ended, nothing can come in between */
+		match = parser->key_match;
+	} else {
+		jsmn_stream_level_t *level = &parser->levels[parser->level - 1];
+		match = jsmn_stream_filter_step(filter, level->match,
+			parser->level - 1, false, 0, NULL, 0, level->index);
+		/* Indices saturate, the filter can't match beyond 254 */
+		if (level->index != 255) {
+			level->index++;
 		}
 	}
-	return JSMN_STREAM_ERROR_PART;
+	parser->value_match = match;
+	return match;
 }
 
 /**
- * Parse JSON string and fill tokens.
+ * A value has been fully parsed or skipped. If it was the value of an object
+ * key, the key is done too.
  */
-int jsmn_stream_parse(jsmn_stream_parser *parser, char c) {
-	jsmn_streamtype_t type;
-	int r;
-
-	switch (parser->state) {
-		case JSMN_STREAM_PARSING:
-			switch (c) {
-				case '{': case '[':
-					if (c == '{') {
-						type = JSMN_STREAM_OBJECT;
-						JSMN_STREAM_CALLBACK(parser->callbacks.start_object_callback,
-							parser->user_arg);
-					} else {
-						type = JSMN_STREAM_ARRAY;
-						JSMN_STREAM_CALLBACK(parser->callbacks.start_array_callback,
-							parser->user_arg);
+static inline void jsmn_stream_value_end(jsmn_stream_parser *parser) {
+	if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
+		jsmn_stream_stack_pop(parser);
+	}
+}
+
+/**
+ * Parse a block of JSON text. The parse state is kept in locals for the
+ * duration of the block; every byte is examined exactly once and runs of
+ * whitespace, string characters and primitive characters are consumed in
+ * tight inner loops. Values excluded by the filter are skipped by counting
+ * brackets only.
+ */
+int jsmn_stream_parse_buf(jsmn_stream_parser *parser, const char *buf, size_t len) {
+	const jsmn_stream_callbacks_t *callbacks = &parser->callbacks;
+	const char *p = buf;
+	const char *end = buf + len;
+	jsmn_streamstate_t state = parser->state;
+	char *buffer = parser->buffer;
+	/* Leave space for the terminating null character */
+	const size_t buffer_limit = parser->buffer_capacity - 1;
+	size_t buffer_size = parser->buffer_size;
+	unsigned short skip_depth = parser->skip_depth;
+	uint32_t key_hash = parser->key_hash;
+	unsigned short key_length = parser->key_length;
+	/*
+	 * Keys are buffered for the filter as far as they fit, longer ones can't
+	 * match. The key callback needs the whole key.
+	 */
+	bool whole_keys = callbacks->object_key_callback != NULL;
+	unsigned char match;
+	int r = 0;
+	char c;
+
+	while (p < end) {
+		c = *p;
+		switch (state) {
+			case JSMN_STREAM_PARSING:
+				switch (c) {
+					case '\t' : case '\r' : case '\n' : case ' ' :
+						/* Skip the whole whitespace run at once */
+						do {
+							p++;
+						} while (p < end && jsmn_stream_is_space(*p));
+						continue;
+					case ',':
+						break;
+					case '{': case '[':
+						match = jsmn_stream_value_start(parser);
+						if (match == 0) {
+							skip_depth = 1;
+							state = JSMN_STREAM_SKIPPING;
+							break;
+						}
+						if (c == '{') {
+							JSMN_STREAM_CALLBACK(callbacks->start_object_callback,
+								parser->user_arg);
+						} else {
+							JSMN_STREAM_CALLBACK(callbacks->start_array_callback,
+								parser->user_arg);
+						}
+						if (!jsmn_stream_stack_push(parser, c == '{' ?
+							JSMN_STREAM_OBJECT : JSMN_STREAM_ARRAY, match)) {
+							r = JSMN_STREAM_ERROR_MAX_DEPTH;
+							goto out;
+						}
+						break;
+					case '}': case ']':
+						if (c == '}') {
+							JSMN_STREAM_CALLBACK(callbacks->end_object_callback,
+								parser->user_arg);
+						} else {
+							JSMN_STREAM_CALLBACK(callbacks->end_array_callback,
+								parser->user_arg);
+						}
+						jsmn_stream_stack_pop(parser);
+						jsmn_stream_value_end(parser);
+						break;
+					case '\"':
+						/* Strings directly inside an object are keys */
+						if (jsmn_stream_stack_top(parser) == JSMN_STREAM_OBJECT) {
+							key_hash = JSMN_STREAM_HASH_INIT;
+							key_length = 0;
+							state = JSMN_STREAM_PARSING_KEY;
+						} else if (jsmn_stream_value_start(parser) & JSMN_STREAM_MATCH_FULL) {
+							state = JSMN_STREAM_PARSING_STRING;
+						} else {
+							skip_depth = 0;
+							state = JSMN_STREAM_SKIPPING_STRING;
+						}
+						break;
+					case ':':
+						if (jsmn_stream_stack_top(parser) == JSMN_STREAM_OBJECT &&
+							!jsmn_stream_stack_push(parser, JSMN_STREAM_KEY,
+								parser->key_match)) {
+							r = JSMN_STREAM_ERROR_MAX_DEPTH;
+							goto out;
+						}
+						break;
+					/* In strict mode primitives are: numbers and booleans */
+					case '-': case '0': case '1' : case '2': case '3' : case '4':
+					case '5': case '6': case '7' : case '8': case '9':
+					case 't': case 'f': case 'n' :
+						if (jsmn_stream_stack_top(parser) == JSMN_STREAM_OBJECT) {
+							r = JSMN_STREAM_ERROR_INVAL;
+							goto out;
+						}
+						/* The primitive state consumes this character */
+						if (!(jsmn_stream_value_start(parser) & JSMN_STREAM_MATCH_FULL)) {
+							state = JSMN_STREAM_SKIPPING_PRIMITIVE;
+						} else if (callbacks->number_callback != NULL &&
+							(c == '-' || (c >= '0' && c <= '9'))) {
+							parser->number_mantissa = 0;
+							parser->number_exponent = 0;
+							parser->number_exp_value = 0;
+							parser->number_phase = JSMN_STREAM_NUMBER_START;
+							parser->number_negative = false;
+							parser->number_exp_negative = false;
+							state = JSMN_STREAM_PARSING_NUMBER;
+						} else {
+							state = JSMN_STREAM_PARSING_PRIMITIVE;
+						}
+						continue;
+					/* Unexpected char in strict mode */
+					default:
+						r = JSMN_STREAM_ERROR_INVAL;
+						goto out;
+				}
+				p++;
+				break;
+
+			case JSMN_STREAM_PARSING_STRING:
+				/* Copy the plain run up to the next quote or backslash */
+				while (c != '\"' && c != '\\') {
+					if (buffer_size == buffer_limit) {
+						r = JSMN_STREAM_ERROR_NOMEM;
+						goto out;
 					}
-					if (!jsmn_stream_stack_push(parser, type)) {
-						return JSMN_STREAM_ERROR_MAX_DEPTH;
+					buffer[buffer_size++] = c;
+					if (++p == end) {
+						goto out;
 					}
+					c = *p;
+				}
+				p++;
+				if (c == '\\') {
+					/* Backslash: Quoted symbol expected */
+					if (buffer_size == buffer_limit) {
+						r = JSMN_STREAM_ERROR_NOMEM;
+						goto out;
+					}
+					buffer[buffer_size++] = c;
+					state = JSMN_STREAM_PARSING_STRING_ESCAPE;
 					break;
-				case '}': case ']':
-					if (c == '}') {
-						JSMN_STREAM_CALLBACK(parser->callbacks.end_object_callback,
-							parser->user_arg);
-					} else {
-						JSMN_STREAM_CALLBACK(parser->callbacks.end_array_callback,
-							parser->user_arg);
+				}
+				/* Quote: end of string */
+				buffer[buffer_size] = '\0';
+				JSMN_STREAM_CALLBACK(callbacks->string_callback,
+					buffer, buffer_size, parser->user_arg);
+				buffer_size = 0;
+				state = JSMN_STREAM_PARSING;
+				jsmn_stream_value_end(parser);
+				break;
+
+			case JSMN_STREAM_PARSING_KEY:
+				/* Hash the key as it streams in, escapes included verbatim */
+				while (c != '\"') {
+					key_hash = JSMN_STREAM_HASH_STEP(key_hash, c);
+					key_length++;
+					if (buffer_size < buffer_limit) {
+						buffer[buffer_size++] = c;
+					} else if (whole_keys) {
+						r = JSMN_STREAM_ERROR_NOMEM;
+						goto out;
 					}
-					jsmn_stream_stack_pop(parser);
-					if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
-						jsmn_stream_stack_pop(parser);
+					p++;
+					if (c == '\\') {
+						state = JSMN_STREAM_PARSING_KEY_ESCAPE;
+						break;
 					}
-					break;
-				case '\"':
-					parser->state = JSMN_STREAM_PARSING_STRING;
-					break;
-				case '\t' : case '\r' : case '\n' : case ' ' : case ',':
-					break;
-				case ':':
-					if (jsmn_stream_stack_top(parser) == JSMN_STREAM_OBJECT &&
-						!jsmn_stream_stack_push(parser, JSMN_STREAM_KEY)) {
-						return JSMN_STREAM_ERROR_MAX_DEPTH;
+					if (p == end) {
+						goto out;
 					}
+					c = *p;
+				}
+				if (c != '\"') {
 					break;
-				/* In strict mode primitives are: numbers and booleans */
-				case '-': case '0': case '1' : case '2': case '3' : case '4':
-				case '5': case '6': case '7' : case '8': case '9':
-				case 't': case 'f': case 'n' :
-					if (jsmn_stream_stack_top(parser) == JSMN_STREAM_OBJECT) {
-						return JSMN_STREAM_ERROR_INVAL;
+				}
+				p++;
+				state = JSMN_STREAM_PARSING;
+				parser->key_match = parser->filter == NULL ?
+					JSMN_STREAM_MATCH_FULL :
+					jsmn_stream_filter_step(parser->filter,
+						parser->levels[parser->level - 1].match,
+						parser->level - 1, true, key_hash, buffer, key_length, 0);
+				if (parser->key_match != 0) {
+					buffer[buffer_size] = '\0';
+					JSMN_STREAM_CALLBACK(callbacks->object_key_callback,
+						buffer, buffer_size, parser->user_arg);
+				}
+				buffer_size = 0;
+				break;
+
+			case JSMN_STREAM_PARSING_KEY_ESCAPE:
+				/* The escaped character can't end the key */
+				key_hash = JSMN_STREAM_HASH_STEP(key_hash, c);
+				key_length++;
+				if (buffer_size < buffer_limit) {
+					buffer[buffer_size++] = c;
+				} else if (whole_keys) {
+					r = JSMN_STREAM_ERROR_NOMEM;
+					goto out;
+				}
+				state = JSMN_STREAM_PARSING_KEY;
+				p++;
+				break;
+
+			case JSMN_STREAM_PARSING_STRING_ESCAPE:
+				switch (c) {
+					/* Allowed escaped symbols */
+					case '\"': case '/' : case '\\' : case 'b' :
+					case 'f' : case 'r' : case 'n'  : case 't' :
+						state = JSMN_STREAM_PARSING_STRING;
+						break;
+					/* Allows escaped symbol \uXXXX */
+					case 'u':
+						parser->unicode_digits = 4;
+						state = JSMN_STREAM_PARSING_STRING_UNICODE;
+						break;
+					/* Unexpected symbol */
+					default:
+						r = JSMN_STREAM_ERROR_INVAL;
+						goto out;
+				}
+				if (buffer_size == buffer_limit) {
+					r = JSMN_STREAM_ERROR_NOMEM;
+					goto out;
+				}
+				buffer[buffer_size++] = c;
+				p++;
+				break;
+
+			case JSMN_STREAM_PARSING_STRING_UNICODE:
+				/* If it isn't a hex character we have an error */
+				if (!jsmn_stream_is_hex(c)) {
+					r = JSMN_STREAM_ERROR_INVAL;
+					goto out;
+				}
+				if (--parser->unicode_digits == 0) {
+					state = JSMN_STREAM_PARSING_STRING;
+				}
+				if (buffer_size == buffer_limit) {
+					r = JSMN_STREAM_ERROR_NOMEM;
+					goto out;
+				}
+				buffer[buffer_size++] = c;
+				p++;
+				break;
+
+			case JSMN_STREAM_PARSING_PRIMITIVE:
+				/* Copy the run up to the first delimiter */
+				while (!jsmn_stream_is_delimiter(c)) {
+					if (c < 32 || c >= 127) {
+						r = JSMN_STREAM_ERROR_INVAL;
+						goto out;
 					}
-					parser->state = JSMN_STREAM_PARSING_PRIMITIVE;
-					jsmn_stream_parse(parser, c);
-					break;
+					if (buffer_size == buffer_limit) {
+						r = JSMN_STREAM_ERROR_NOMEM;
+						goto out;
+					}
+					buffer[buffer_size++] = c;
+					/* In strict mode primitive must be followed by a
+					 * comma/object/array */
+					if (++p == end) {
+						goto out;
+					}
+					c = *p;
+				}
+				buffer[buffer_size] = '\0';
+				JSMN_STREAM_CALLBACK(callbacks->primitive_callback,
+					buffer, buffer_size, parser->user_arg);
+				buffer_size = 0;
+				state = JSMN_STREAM_PARSING;
+				jsmn_stream_value_end(parser);
+				/* The delimiter is handled in the parsing state */
+				break;
 
-				/* Unexpected char in strict mode */
-				default:
-					return JSMN_STREAM_ERROR_INVAL;
-			}
-			break;
+			case JSMN_STREAM_PARSING_NUMBER:
+				/* Accumulate the value digit by digit, nothing is buffered */
+				while (!jsmn_stream_is_delimiter(c)) {
+					unsigned char phase = parser->number_phase;
+					if (c >= '0' && c <= '9') {
+						if (phase >= JSMN_STREAM_NUMBER_EXP_START) {
+							/* Saturate before another digit could overflow */
+							if (parser->number_exp_value <= (JSMN_STREAM_EXP_MAX - 9) / 10) {
+								parser->number_exp_value =
+									parser->number_exp_value * 10 + (c - '0');
+							} else {
+								parser->number_exp_value = JSMN_STREAM_EXP_MAX;
+							}
+							phase = JSMN_STREAM_NUMBER_EXP;
+						} else {
+							if (JSMN_STREAM_MANTISSA_FITS(parser->number_mantissa, c - '0')) {
+								parser->number_mantissa =
+									parser->number_mantissa * 10 + (c - '0');
+								if (phase == JSMN_STREAM_NUMBER_FRAC) {
+									parser->number_exponent--;
+								}
+							} else if (phase != JSMN_STREAM_NUMBER_FRAC &&
+								parser->number_exponent < JSMN_STREAM_EXP_MAX) {
+								/* Integer digit that doesn't fit */
+								parser->number_exponent++;
+							}
+							if (phase == JSMN_STREAM_NUMBER_START) {
+								phase = JSMN_STREAM_NUMBER_INT;
+							}
+						}
+					} else if (c == '-' && phase == JSMN_STREAM_NUMBER_START &&
+						!parser->number_negative) {
+						parser->number_negative = true;
+					} else if ((c == '-' || c == '+') &&
+						phase == JSMN_STREAM_NUMBER_EXP_START) {
+						parser->number_exp_negative = c == '-';
+						phase = JSMN_STREAM_NUMBER_EXP_SIGN;
+					} else if (c == '.' && phase == JSMN_STREAM_NUMBER_INT) {
+						phase = JSMN_STREAM_NUMBER_FRAC;
+					} else if ((c == 'e' || c == 'E') &&
+						(phase == JSMN_STREAM_NUMBER_INT ||
+						 phase == JSMN_STREAM_NUMBER_FRAC)) {
+						phase = JSMN_STREAM_NUMBER_EXP_START;
+					} else {
+						r = JSMN_STREAM_ERROR_INVAL;
+						goto out;
+					}
+					parser->number_phase = phase;
+					if (++p == end) {
+						goto out;
+					}
+					c = *p;
+				}
+				if (parser->number_phase == JSMN_STREAM_NUMBER_START ||
+					parser->number_phase == JSMN_STREAM_NUMBER_EXP_START ||
+					parser->number_phase == JSMN_STREAM_NUMBER_EXP_SIGN) {
+					r = JSMN_STREAM_ERROR_INVAL;
+					goto out;
+				}
+				callbacks->number_callback(parser->number_negative ?
+					-(int32_t)parser->number_mantissa :
+					(int32_t)parser->number_mantissa,
+					parser->number_exponent + (parser->number_exp_negative ?
+						-parser->number_exp_value : parser->number_exp_value),
+					parser->user_arg);
+				state = JSMN_STREAM_PARSING;
+				jsmn_stream_value_end(parser);
+				/* The delimiter is handled in the parsing state */
+				break;
 
-		case JSMN_STREAM_PARSING_STRING:
-			r = jsmn_stream_parse_string(parser, c);
-			if (r < 0) return r;
-			if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
-				jsmn_stream_stack_pop(parser);
-			}
-			break;
+			case JSMN_STREAM_SKIPPING:
+				/* Only brackets and quotes matter inside a skipped value */
+				for (;;) {
+					if (c == '\"') {
+						state = JSMN_STREAM_SKIPPING_STRING;
+						break;
+					} else if (c == '{' || c == '[') {
+						skip_depth++;
+					} else if ((c == '}' || c == ']') && --skip_depth == 0) {
+						state = JSMN_STREAM_PARSING;
+						jsmn_stream_value_end(parser);
+						break;
+					}
+					if (++p == end) {
+						goto out;
+					}
+					c = *p;
+				}
+				p++;
+				break;
 
-		case JSMN_STREAM_PARSING_PRIMITIVE:
-			r = jsmn_stream_parse_primitive(parser, c);
-			if (r < 0) return r;
-			else if (r == 0) {
-				if (jsmn_stream_stack_top(parser) == JSMN_STREAM_KEY) {
-					jsmn_stream_stack_pop(parser);
+			case JSMN_STREAM_SKIPPING_STRING:
+				p = jsmn_stream_scan_string(p, end);
+				if (p == end) {
+					goto out;
 				}
-				return jsmn_stream_parse(parser, c);
-			}
-			break;
+				c = *p++;
+				if (c == '\\') {
+					state = JSMN_STREAM_SKIPPING_STRING_ESCAPE;
+				} else if (skip_depth == 0) {
+					state = JSMN_STREAM_PARSING;
+					jsmn_stream_value_end(parser);
+				} else {
+					state = JSMN_STREAM_SKIPPING;
+				}
+				break;
+
+			case JSMN_STREAM_SKIPPING_STRING_ESCAPE:
+				/* The escaped character can't end the string */
+				state = JSMN_STREAM_SKIPPING_STRING;
+				p++;
+				break;
+
+			case JSMN_STREAM_SKIPPING_PRIMITIVE:
+				while (!jsmn_stream_is_delimiter(c)) {
+					if (++p == end) {
+						goto out;
+					}
+					c = *p;
+				}
+				state = JSMN_STREAM_PARSING;
+				jsmn_stream_value_end(parser);
+				/* The delimiter is handled in the parsing state */
+				break;
+		}
 	}
 
-	return 0;
+out:
+	parser->state = state;
+	parser->buffer_size = buffer_size;
+	parser->skip_depth = skip_depth;
+	parser->key_hash = key_hash;
+	parser->key_length = key_length;
+	return r < 0 ? r : (int)(p - buf);
+}
+
+/**
+ * Parse JSON string and fill tokens.
+ */
+int jsmn_stream_parse(jsmn_stream_parser *parser, char c) {
+	int r = jsmn_stream_parse_buf(parser, &c, 1);
+	return r < 0 ? r : 0;
 }
 
 /**
- * Creates a new parser based over a given  buffer with an array of tokens
- * available.
+ * Creates a new parser over caller supplied storage.
  */
 void jsmn_stream_init(jsmn_stream_parser *parser,
-	jsmn_stream_callbacks_t *callbacks, void *user_arg) {
-	parser->state = JSMN_STREAM_PARSING;
-	parser->stack_height = 0;
-	parser->buffer_size = 0;
+	jsmn_stream_callbacks_t *callbacks, void *user_arg,
+	char *buffer, size_t buffer_size,
+	unsigned char *type_stack, jsmn_stream_level_t *levels, size_t max_depth) {
 	parser->callbacks = *callbacks;
 	parser->user_arg = user_arg;
+	parser->filter = NULL;
+	parser->buffer = buffer;
+	parser->type_stack = type_stack;
+	parser->levels = levels;
+	parser->key_hash = JSMN_STREAM_HASH_INIT;
+	parser->number_mantissa = 0;
+	parser->buffer_capacity = buffer_size > 0xffff ? 0xffff : buffer_size;
+	parser->buffer_size = 0;
+	parser->key_length = 0;
+	parser->skip_depth = 0;
+	parser->number_exponent = 0;
+	parser->number_exp_value = 0;
+	parser->state = JSMN_STREAM_PARSING;
+	parser->max_depth = max_depth > 255 ? 255 : max_depth;
+	parser->level = 0;
+	parser->unicode_digits = 0;
+	parser->number_phase = JSMN_STREAM_NUMBER_START;
+	parser->number_negative = false;
+	parser->number_exp_negative = false;
+	parser->key_match = 0;
+	parser->value_match = 0;
+}
+
+int jsmn_stream_set_filter(jsmn_stream_parser *parser,
+	const jsmn_stream_filter_t *filter) {
+	size_t i;
+
+	if (filter != NULL && parser->levels == NULL) {
+		return JSMN_STREAM_ERROR_NOMEM;
+	}
+	/* Keys longer than the buffer can't be compared */
+	for (i = 0; filter != NULL && i < filter->path_start[filter->path_count]; i++) {
+		if (filter->segments[i].key_length >= parser->buffer_capacity) {
+			return JSMN_STREAM_ERROR_NOMEM;
+		}
+	}
+	parser->filter = filter;
+	return 0;
 }
 
+int jsmn_stream_filter_match(const jsmn_stream_parser *parser) {
+	if (parser->filter == NULL ||
+		!(parser->value_match & JSMN_STREAM_MATCH_FULL)) {
+		return -1;
+	}
+	return parser->value_match & ~JSMN_STREAM_MATCH_FULL;
+}
+
+bool jsmn_stream_filter_reaches(const jsmn_stream_parser *parser, size_t path) {
+	unsigned char match = parser->value_match;
+
+	if (parser->filter == NULL) {
+		return false;
+	}
+	if (match & JSMN_STREAM_MATCH_FULL) {
+		return (size_t)(match & ~JSMN_STREAM_MATCH_FULL) == path;
+	}
+	return path < JSMN_STREAM_FILTER_MAX_PATHS && (match & (1 << path)) != 0;
+}
+
+/**
+ * Compiles path patterns of the form key.key[index][*].* into segments.
+ */
+int jsmn_stream_filter_compile(jsmn_stream_filter_t *filter,
+	const char * const *paths, size_t path_count) {
+	size_t n = 0;
+	size_t i;
+
+	if (path_count > JSMN_STREAM_FILTER_MAX_PATHS) {
+		return JSMN_STREAM_ERROR_NOMEM;
+	}
+	for (i = 0; i < path_count; i++) {
+		const char *s = paths[i];
+		filter->path_start[i] = n;
+		while (*s != '\0') {
+			if (n == JSMN_STREAM_FILTER_MAX_SEGMENTS) {
+				return JSMN_STREAM_ERROR_NOMEM;
+			}
+			jsmn_stream_path_segment_t *seg = &filter->segments[n];
+			seg->key_hash = 0;
+			seg->key = NULL;
+			seg->key_length = 0;
+			seg->index = 0;
+			if (*s == '[') {
+				s++;
+				if (*s == '*') {
+					seg->type = JSMN_STREAM_SEGMENT_ANY_INDEX;
+					s++;
+				} else if (*s >= '0' && *s <= '9') {
+					seg->type = JSMN_STREAM_SEGMENT_INDEX;
+					while (*s >= '0' && *s <= '9') {
+						seg->index = seg->index * 10 + (*s++ - '0');
+						/* Array indices saturate at 255 while parsing */
+						if (seg->index > 254) {
+							return JSMN_STREAM_ERROR_INVAL;
+						}
+					}
+				} else {
+					return JSMN_STREAM_ERROR_INVAL;
+				}
+				if (*s++ != ']') {
+					return JSMN_STREAM_ERROR_INVAL;
+				}
+			} else {
+				/* Keys after the first segment are separated by dots */
+				if (n > filter->path_start[i] && *s++ != '.') {
+					return JSMN_STREAM_ERROR_INVAL;
+				}
+				const char *key = s;
+				while (*s != '\0' && *s != '.' && *s != '[') {
+					s++;
+				}
+				if (s == key || s - key > 255) {
+					return JSMN_STREAM_ERROR_INVAL;
+				}
+				seg->key = key;
+				seg->key_length = s - key;
+				seg->key_hash = jsmn_stream_hash(key, seg->key_length);
+				seg->type = seg->key_length == 1 && key[0] == '*' ?
+					JSMN_STREAM_SEGMENT_ANY_KEY : JSMN_STREAM_SEGMENT_KEY;
+			}
+			n++;
+		}
+	}
+	filter->path_start[path_count] = n;
+	filter->path_count = path_count;
+	return 0;
+}
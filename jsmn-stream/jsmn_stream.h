@@ -6,15 +6,23 @@
 #define __JSMN_STREAM_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* Determines the maximal nesting level of the JSON */
-#define JSMN_STREAM_MAX_DEPTH 32
-/* Determines the maximal length a primitive or a string can have */
-#define JSMN_STREAM_BUFFER_SIZE 512
+/* Bytes of type stack needed for a maximal nesting level, 2 bits per level */
+#define JSMN_STREAM_TYPE_STACK_SIZE(depth) (((depth) + 3) / 4)
+/* Determines the maximal number of path patterns in a filter */
+#define JSMN_STREAM_FILTER_MAX_PATHS 7
+/* Determines the maximal number of path segments in a filter, in total */
+#define JSMN_STREAM_FILTER_MAX_SEGMENTS 24
+/* Scan skipped strings a 32-bit word at a time, 0 for a byte at a time */
+#ifndef JSMN_STREAM_SWAR
+#define JSMN_STREAM_SWAR 1
+#endif
 
 /**
  * JSON type identifier. Basic types are:
@@ -46,9 +54,49 @@ enum jsmn_streamerr {
 typedef enum {
     JSMN_STREAM_PARSING = 0,
     JSMN_STREAM_PARSING_STRING = 1,
-    JSMN_STREAM_PARSING_PRIMITIVE = 2
+    JSMN_STREAM_PARSING_PRIMITIVE = 2,
+    JSMN_STREAM_PARSING_STRING_ESCAPE = 3,
+    JSMN_STREAM_PARSING_STRING_UNICODE = 4,
+    JSMN_STREAM_SKIPPING = 5,
+    JSMN_STREAM_SKIPPING_STRING = 6,
+    JSMN_STREAM_SKIPPING_STRING_ESCAPE = 7,
+    JSMN_STREAM_SKIPPING_PRIMITIVE = 8,
+    JSMN_STREAM_PARSING_KEY = 9,
+    JSMN_STREAM_PARSING_KEY_ESCAPE = 10,
+    JSMN_STREAM_PARSING_NUMBER = 11
 } jsmn_streamstate_t;
 
+/**
+ * Path segment types. A path such as "list[*].weather[0].icon" compiles into
+ * the segments KEY("list"), ANY_INDEX, KEY("weather"), INDEX(0), KEY("icon").
+ * A "*" key matches any object key.
+ */
+typedef enum {
+	JSMN_STREAM_SEGMENT_KEY = 0,
+	JSMN_STREAM_SEGMENT_ANY_KEY = 1,
+	JSMN_STREAM_SEGMENT_INDEX = 2,
+	JSMN_STREAM_SEGMENT_ANY_INDEX = 3
+} jsmn_stream_segmenttype_t;
+
+typedef struct {
+	uint32_t key_hash;
+	const char *key; /* Not null-terminated, NULL for index segments */
+	unsigned short index;
+	unsigned char key_length;
+	unsigned char type; /* jsmn_stream_segmenttype_t */
+} jsmn_stream_path_segment_t;
+
+/**
+ * A compiled list of path patterns. Values whose path cannot match any of
+ * the patterns are skipped without buffering and without firing callbacks.
+ * Containers on the way to a match still fire their start/end callbacks.
+ */
+typedef struct {
+	jsmn_stream_path_segment_t segments[JSMN_STREAM_FILTER_MAX_SEGMENTS];
+	unsigned char path_start[JSMN_STREAM_FILTER_MAX_PATHS + 1];
+	unsigned char path_count;
+} jsmn_stream_filter_t;
+
 /**
  * A structure containing callbacks for the parse events.
  */
@@ -60,28 +108,97 @@ typedef struct {
 	void (* object_key_callback)(const char *key, size_t key_length, void *user_arg);
 	void (* string_callback)(const char *value, size_t length, void *user_arg);
 	void (* primitive_callback)(const char *value, size_t length, void *user_arg);
+	/*
+	 * Number with the value mantissa * 10^exponent. If this is set, numbers
+	 * are decoded while streaming and not passed to primitive_callback.
+	 * Digits that don't fit the mantissa are truncated.
+	 */
+	void (* number_callback)(int32_t mantissa, int exponent, void *user_arg);
 } jsmn_stream_callbacks_t;
 
 /**
- * JSON parser. Stores the internal state of the parser and a necessary buffer
- * for parsing primitives.
+ * Per nesting level state needed by the filter.
+ */
+typedef struct {
+	unsigned char match; /* Filter match state of the container */
+	unsigned char index; /* Element count of an array, saturates at 255 */
+} jsmn_stream_level_t;
+
+/**
+ * JSON parser. Stores the internal state of the parser. The buffer for
+ * strings and primitives and the stacks are supplied by the caller, which
+ * also determines the maximal token length and nesting level.
  */
 typedef struct {
-    jsmn_streamstate_t state;
 	jsmn_stream_callbacks_t callbacks; /* callbacks for parse events */
-	jsmn_streamtype_t type_stack[JSMN_STREAM_MAX_DEPTH]; /* Stack for storing the type structure */
-	size_t stack_height;
-	char buffer[JSMN_STREAM_BUFFER_SIZE];
-	size_t buffer_size;
 	void *user_arg;
+	const jsmn_stream_filter_t *filter;
+	char *buffer;
+	unsigned char *type_stack; /* Stack for storing the type structure */
+	jsmn_stream_level_t *levels;
+	uint32_t key_hash; /* Hash of the key read so far */
+	uint32_t number_mantissa; /* Absolute value of the digits read so far */
+	unsigned short buffer_capacity;
+	unsigned short buffer_size;
+	unsigned short key_length;
+	unsigned short skip_depth; /* Nesting level inside a skipped value */
+	short number_exponent; /* Decimal exponent implied by the digits so far */
+	short number_exp_value; /* Explicit exponent after e/E */
+	unsigned char state; /* jsmn_streamstate_t */
+	unsigned char max_depth;
+	unsigned char level; /* Number of containers on the stack */
+	unsigned char unicode_digits; /* Hex digits still expected in \uXXXX */
+	unsigned char number_phase;
+	bool number_negative;
+	bool number_exp_negative;
+	unsigned char key_match; /* Filter match state of the last key */
+	unsigned char value_match; /* Filter match state of the current value */
 } jsmn_stream_parser;
 
 /**
  * Create JSON parser given an array of event callbacks and an optional user
- * argument that is passed to the callbacks.
+ * argument that is passed to the callbacks. Strings and primitives up to
+ * buffer_size - 1 characters are buffered in buffer (at most 65535 bytes).
+ * The JSON may nest up to max_depth (at most 255) levels; type_stack must
+ * hold JSMN_STREAM_TYPE_STACK_SIZE(max_depth) bytes. levels must hold
+ * max_depth entries if a filter is used, otherwise it may be NULL.
  */
 void jsmn_stream_init(jsmn_stream_parser *parser,
-	jsmn_stream_callbacks_t *callbacks, void *user_arg);
+	jsmn_stream_callbacks_t *callbacks, void *user_arg,
+	char *buffer, size_t buffer_size,
+	unsigned char *type_stack, jsmn_stream_level_t *levels, size_t max_depth);
+
+/**
+ * Compile path patterns into a filter. Keys point into the pattern strings,
+ * which must outlive the filter. Returns 0 on success,
+ * JSMN_STREAM_ERROR_INVAL for a malformed pattern or JSMN_STREAM_ERROR_NOMEM
+ * if the filter limits are exceeded.
+ */
+int jsmn_stream_filter_compile(jsmn_stream_filter_t *filter,
+	const char * const *paths, size_t path_count);
+
+/**
+ * Restrict the parse events to values matching the filter. NULL removes the
+ * filter. Must be called before parsing starts. Returns
+ * JSMN_STREAM_ERROR_NOMEM if the parser has no levels storage or if a key of
+ * the filter doesn't fit the buffer, where keys are compared.
+ */
+int jsmn_stream_set_filter(jsmn_stream_parser *parser,
+	const jsmn_stream_filter_t *filter);
+
+/**
+ * Index of the filter path that the value being reported matches, or -1 if
+ * it is only on the way to a match or there is no filter. Values inside a
+ * matched container report the path of the container.
+ */
+int jsmn_stream_filter_match(const jsmn_stream_parser *parser);
+
+/**
+ * Whether the value being reported matches filter path path or is on the way
+ * to it. Valid in the start callbacks of a container, not in the end ones.
+ * Always false without a filter.
+ */
+bool jsmn_stream_filter_reaches(const jsmn_stream_parser *parser, size_t path);
 
 /**
  * Run JSON parser. It incrementally parses a JSON string character by
@@ -90,6 +207,14 @@ void jsmn_stream_init(jsmn_stream_parser *parser,
  */
 int jsmn_stream_parse(jsmn_stream_parser *parser, char c);
 
+/**
+ * Run JSON parser over a block of len bytes, e.g. a whole received packet.
+ * This is equivalent to calling jsmn_stream_parse for every byte but avoids
+ * the per-byte call and state dispatch overhead. Returns the number of bytes
+ * consumed or a negative jsmn_streamerr if the input is invalid.
+ */
+int jsmn_stream_parse_buf(jsmn_stream_parser *parser, const char *buf, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,146 @@
+#include "dns_cache.h"
+
+#include <osapi.h>
+#include <mem.h>
+#include <user_interface.h>
+#include <espmissingincludes.h>
+
+#include "util.h"
+
+#define DNS_CACHE_MAGIC 0x0d45cace
+
+typedef struct {
+    uint32_t name_hash;     // Of the hostname, 0 if unused
+    uint32_t addr;
+    uint32_t resolved;      // rtc_clock_us() in seconds
+} dns_cache_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    dns_cache_entry_t entries[DNS_CACHE_ENTRIES];
+} dns_cache_t;
+
+// A query on its way, the callback is NULL for a background refresh
+typedef struct {
+    uint32_t name_hash;
+    dns_found_callback found;
+    void *arg;
+} dns_query_t;
+
+static uint8_t cache_slot;
+static dns_cache_t cache;
+
+static uint32_t now(void) {
+    return rtc_clock_us() / 1000000;
+}
+
+static uint32_t name_hash(const char *hostname) {
+    uint32_t hash = hash_update(HASH_INIT, hostname, os_strlen(hostname));
+    return hash != 0 ? hash : 1;
+}
+
+static dns_cache_entry_t *find(uint32_t hash) {
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        if (cache.entries[i].name_hash == hash) {
+            return &cache.entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void store(uint32_t hash, const ip_addr_t *addr) {
+    dns_cache_entry_t *entry = find(hash);
+    if (entry == NULL) {
+        // Take an unused entry, or else replace the oldest one. An entry
+        // resolved within a second of power up is as old as an unused one.
+        entry = &cache.entries[0];
+        for (int i = 1; i < DNS_CACHE_ENTRIES && entry->name_hash != 0; i++) {
+            if (cache.entries[i].name_hash == 0 ||
+                cache.entries[i].resolved < entry->resolved) {
+                entry = &cache.entries[i];
+            }
+        }
+    }
+    entry->name_hash = hash;
+    entry->addr = addr->addr;
+    entry->resolved = now();
+    system_rtc_mem_write(cache_slot, &cache, sizeof(cache));
+}
+
+static void query_done(const char *name, ip_addr_t *addr, void *arg) {
+    dns_query_t *query = (dns_query_t *)arg;
+
+    if (addr != NULL) {
+        store(query->name_hash, addr);
+    } else if (query->found == NULL) {
+        os_printf("DNS refresh failed for %s\n", name);
+    }
+    if (query->found != NULL) {
+        query->found(name, addr, query->arg);
+    }
+    os_free(query);
+}
+
+// Starts a query that updates the cache before calling found
+static err_t query(const char *hostname, uint32_t hash, ip_addr_t *addr,
+    dns_found_callback found, void *arg) {
+    dns_query_t *q = (dns_query_t *)os_malloc(sizeof(dns_query_t));
+    if (q == NULL) {
+        return found != NULL ?
+            dns_gethostbyname(hostname, addr, found, arg) : ERR_MEM;
+    }
+    q->name_hash = hash;
+    q->found = found;
+    q->arg = arg;
+
+    err_t err = dns_gethostbyname(hostname, addr, query_done, q);
+    if (err != ERR_INPROGRESS) {
+        // Answered from the lwIP table or an IP address, or an error
+        if (err == ERR_OK) {
+            store(hash, addr);
+        }
+        os_free(q);
+    }
+    return err;
+}
+
+void dns_cache_init(uint8_t slot) {
+    cache_slot = slot;
+    if (!system_rtc_mem_read(slot, &cache, sizeof(cache)) ||
+        cache.magic != DNS_CACHE_MAGIC) {
+        os_memset(&cache, 0, sizeof(cache));
+        cache.magic = DNS_CACHE_MAGIC;
+    }
+}
+
+err_t dns_cache_gethostbyname(const char *hostname, ip_addr_t *addr,
+    dns_found_callback found, void *callback_arg) {
+    if (cache_slot == 0) {
+        return dns_gethostbyname(hostname, addr, found, callback_arg);
+    }
+
+    uint32_t hash = name_hash(hostname);
+    dns_cache_entry_t *entry = find(hash);
+    if (entry == NULL) {
+        return query(hostname, hash, addr, found, callback_arg);
+    }
+
+    if (now() - entry->resolved >= DNS_CACHE_TTL) {
+        ip_addr_t fresh;
+        query(hostname, hash, &fresh, NULL, NULL);
+        // A synchronous answer may have moved the entry
+        entry = find(hash);
+    }
+    addr->addr = entry->addr;
+    return ERR_OK;
+}
+
+void dns_cache_forget(const char *hostname) {
+    if (cache_slot == 0) return;
+
+    dns_cache_entry_t *entry = find(name_hash(hostname));
+    if (entry != NULL) {
+        os_memset(entry, 0, sizeof(*entry));
+        system_rtc_mem_write(cache_slot, &cache, sizeof(cache));
+    }
+}
@@ -0,0 +1,52 @@
+#include "fetch_schedule.h"
+
+uint32_t fetch_schedule_next(fetch_schedule_t *schedule, fetch_result_t result,
+    uint32_t failures, time_t now, time_t stale, uint32_t jitter) {
+    if (result == FETCH_FAILED) {
+        if (failures > DATA_FETCH_MAX_BACKOFF) {
+            failures = DATA_FETCH_MAX_BACKOFF;
+        }
+        return DATA_FETCH_INTERVAL << failures;
+    }
+    if (result == FETCH_UPDATED) {
+        schedule->last_change = now;
+        schedule->misses = 0;
+    }
+
+    time_t next = now + DATA_FETCH_INTERVAL / 1000;
+    if (schedule->last_change != 0 && schedule->last_change <= now) {
+        time_t due = schedule->last_change + FORECAST_UPDATE_INTERVAL;
+        if (due > now) {
+            next = due;
+        } else {
+            int backoff = schedule->misses < DATA_FETCH_MAX_BACKOFF ?
+                schedule->misses : DATA_FETCH_MAX_BACKOFF;
+            next = now + ((DATA_FETCH_INTERVAL / 1000) << backoff);
+            schedule->misses += 1;
+        }
+    }
+    if (stale > now && stale < next) {
+        next = stale;
+    }
+    next += jitter;
+
+    uint32_t interval = DATA_FETCH_INTERVAL;
+    if (now != 0) {
+        interval = (next - now) * 1000;
+        if (interval < DATA_FETCH_INTERVAL) {
+            interval = DATA_FETCH_INTERVAL;
+        } else if (interval > DATA_FETCH_MAX_INTERVAL) {
+            interval = DATA_FETCH_MAX_INTERVAL;
+        }
+    }
+    schedule->next_fetch = now != 0 ? now + interval / 1000 : 0;
+    return interval;
+}
+
+uint32_t fetch_schedule_remaining(const fetch_schedule_t *schedule, time_t now) {
+    if (now == 0 || schedule->next_fetch <= now ||
+        schedule->next_fetch - now > DATA_FETCH_MAX_INTERVAL / 1000) {
+        return DATA_FETCH_INTERVAL;
+    }
+    return (schedule->next_fetch - now) * 1000;
+}
@@ -0,0 +1,515 @@
+#include "inflate.h"
+
+#include <osapi.h>
+#include <espmissingincludes.h>
+
+// The decoder is resumable at every step, so a step only starts once the
+// bits it needs are buffered. No step needs more than 16 bits and the
+// buffer is topped up to at least 25 bits while there is input.
+enum {
+    S_ZLIB_HEADER,
+    S_GZIP_HEADER,
+    S_GZIP_XLEN,
+    S_GZIP_SKIP,
+    S_GZIP_NAME,
+    S_GZIP_COMMENT,
+    S_BLOCK,
+    S_STORED,
+    S_STORED_CHECK,
+    S_STORED_COPY,
+    S_DYNAMIC,
+    S_CODE_LENS,
+    S_LENGTHS,
+    S_CODES,
+    S_LENGTH_EXTRA,
+    S_DIST,
+    S_DIST_EXTRA,
+    S_TRAILER,
+    S_DONE,
+    S_ERROR
+};
+
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+#define GZIP_FRESERVED 0xe0
+
+#define DECODE_NEED_BITS -1
+#define DECODE_INVALID -2
+
+#define NEED_BITS(n) do { if (inf->bit_count < (n)) return false; } while (0)
+#define BITS(n) (inf->bit_buffer & ((1UL << (n)) - 1))
+#define DROP_BITS(n) do { \
+        inf->bit_buffer >>= (n); \
+        inf->bit_count -= (n); \
+    } while (0)
+#define FAIL() do { inf->state = S_ERROR; return true; } while (0)
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t len) {
+    // Bitwise, a table would cost 1 KB of RAM for a few KB of output
+    crc = ~crc;
+    while (len-- > 0) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320UL & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *p, size_t len) {
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (len > 0) {
+        // The largest run before b can overflow
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n-- > 0) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Passes on the output written to the window since the last flush
+static void flush(inflate_t *inf) {
+    size_t len = inf->window_pos - inf->flush_pos;
+    const uint8_t *p = inf->window + inf->flush_pos;
+
+    inf->flush_pos = inf->window_pos;
+    if (len == 0 || inf->stopped) return;
+    if (inf->format == INFLATE_FORMAT_GZIP) {
+        inf->check = crc32_update(inf->check, p, len);
+    } else if (inf->format == INFLATE_FORMAT_ZLIB) {
+        inf->check = adler32_update(inf->check, p, len);
+    }
+    if (!inf->output((const char *)p, len, inf->arg)) {
+        inf->stopped = true;
+    }
+}
+
+static void put(inflate_t *inf, uint8_t c) {
+    inf->window[inf->window_pos++] = c;
+    inf->total_out++;
+    if (inf->window_pos == inf->window_size) {
+        flush(inf);
+        inf->window_pos = 0;
+        inf->flush_pos = 0;
+    }
+}
+
+static bool copy_match(inflate_t *inf, unsigned dist) {
+    if (dist > inf->window_size || dist > inf->total_out) return false;
+
+    size_t from = (inf->window_pos - dist) & (inf->window_size - 1);
+    for (unsigned i = 0; i < inf->length && !inf->stopped; i++) {
+        put(inf, inf->window[from]);
+        from = (from + 1) & (inf->window_size - 1);
+    }
+    return true;
+}
+
+// Returns false if the code is over-subscribed
+static bool build_code(uint16_t *counts, uint16_t *symbols,
+    const uint8_t *lengths, unsigned n) {
+    uint16_t offsets[16];
+    unsigned i;
+
+    os_memset(counts, 0, 16 * sizeof(counts[0]));
+    for (i = 0; i < n; i++) {
+        counts[lengths[i]]++;
+    }
+    counts[0] = 0;
+
+    int left = 1;
+    unsigned sum = 0;
+    for (i = 1; i < 16; i++) {
+        left = 2 * left - counts[i];
+        if (left < 0) return false;
+        offsets[i] = sum;
+        sum += counts[i];
+    }
+
+    for (i = 0; i < n; i++) {
+        if (lengths[i] != 0) {
+            symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+// Decodes a symbol from the buffered bits without consuming them, an
+// incomplete code leaves some bit patterns invalid
+static int decode(const uint16_t *counts, const uint16_t *symbols,
+    uint32_t bits, unsigned available, unsigned *used) {
+    int code = 0;
+    int first = 0;
+    for (unsigned len = 1; len < 16; len++) {
+        if (len > available) return DECODE_NEED_BITS;
+        code = 2 * code + (bits & 1);
+        bits >>= 1;
+        first += counts[len];
+        code -= counts[len];
+        if (code < 0) {
+            *used = len;
+            return symbols[first + code];
+        }
+    }
+    return DECODE_INVALID;
+}
+
+static void build_fixed_codes(inflate_t *inf) {
+    unsigned i;
+    for (i = 0; i < 144; i++) inf->lengths[i] = 8;
+    for (; i < 256; i++) inf->lengths[i] = 9;
+    for (; i < 280; i++) inf->lengths[i] = 7;
+    for (; i < 288; i++) inf->lengths[i] = 8;
+    build_code(inf->lit_counts, inf->lit_symbols, inf->lengths, 288);
+    os_memset(inf->lengths, 5, 32);
+    build_code(inf->dist_counts, inf->dist_symbols, inf->lengths, 32);
+}
+
+// Picks the next optional gzip header field
+static int gzip_next_field(inflate_t *inf) {
+    if (inf->flags & GZIP_FEXTRA) {
+        inf->flags &= ~GZIP_FEXTRA;
+        return S_GZIP_XLEN;
+    } else if (inf->flags & GZIP_FNAME) {
+        inf->flags &= ~GZIP_FNAME;
+        return S_GZIP_NAME;
+    } else if (inf->flags & GZIP_FCOMMENT) {
+        inf->flags &= ~GZIP_FCOMMENT;
+        return S_GZIP_COMMENT;
+    } else if (inf->flags & GZIP_FHCRC) {
+        inf->flags &= ~GZIP_FHCRC;
+        inf->length = 2;
+        return S_GZIP_SKIP;
+    }
+    return S_BLOCK;
+}
+
+// Checks the stream trailer one byte at a time
+static void check_trailer(inflate_t *inf, uint8_t c) {
+    if (inf->format == INFLATE_FORMAT_ZLIB) {
+        // Adler-32, big endian
+        inf->trailer = (inf->trailer << 8) | c;
+        if (++inf->count == 4) {
+            inf->state = inf->trailer == inf->check ? S_DONE : S_ERROR;
+        }
+    } else {
+        // CRC-32 and the length modulo 2^32, both little endian
+        inf->trailer |= (uint32_t)c << (8 * (inf->count & 3));
+        if (++inf->count == 4) {
+            inf->state = inf->trailer == inf->check ? S_TRAILER : S_ERROR;
+            inf->trailer = 0;
+        } else if (inf->count == 8) {
+            inf->state = inf->trailer == inf->total_out ? S_DONE : S_ERROR;
+        }
+    }
+}
+
+static void end_block(inflate_t *inf) {
+    inf->state = inf->final ? S_TRAILER : S_BLOCK;
+    inf->count = 0;
+}
+
+// Runs one step of the decoder. Returns false if more bits are needed.
+static bool step(inflate_t *inf) {
+    unsigned used;
+    int sym;
+
+    switch (inf->state) {
+    case S_ZLIB_HEADER: {
+        NEED_BITS(16);
+        unsigned cmf = BITS(8);
+        unsigned flg = (inf->bit_buffer >> 8) & 0xff;
+        if ((cmf & 0x0f) == 8 && (cmf >> 4) <= 7 &&
+            ((cmf << 8) | flg) % 31 == 0) {
+            // A preset dictionary isn't something a server can use
+            if (flg & 0x20) FAIL();
+            DROP_BITS(16);
+            inf->check = 1;
+        } else {
+            // Raw deflate data from a server that left the wrapper out
+            inf->format = INFLATE_FORMAT_RAW;
+        }
+        inf->state = S_BLOCK;
+        return true;
+    }
+
+    case S_GZIP_HEADER: {
+        NEED_BITS(8);
+        uint8_t c = BITS(8);
+        DROP_BITS(8);
+        switch (inf->count++) {
+        case 0: if (c != 0x1f) FAIL(); break;
+        case 1: if (c != 0x8b) FAIL(); break;
+        case 2: if (c != 8) FAIL(); break;
+        case 3:
+            if (c & GZIP_FRESERVED) FAIL();
+            inf->flags = c;
+            break;
+        case 9:
+            // Time, extra flags and OS don't matter
+            inf->state = gzip_next_field(inf);
+            break;
+        }
+        return true;
+    }
+
+    case S_GZIP_XLEN:
+        NEED_BITS(16);
+        inf->length = BITS(16);
+        DROP_BITS(16);
+        inf->state = S_GZIP_SKIP;
+        return true;
+
+    case S_GZIP_SKIP:
+        while (inf->length > 0) {
+            NEED_BITS(8);
+            DROP_BITS(8);
+            inf->length--;
+        }
+        inf->state = gzip_next_field(inf);
+        return true;
+
+    case S_GZIP_NAME:
+    case S_GZIP_COMMENT: {
+        // Zero terminated
+        NEED_BITS(8);
+        uint8_t c = BITS(8);
+        DROP_BITS(8);
+        if (c == '\0') {
+            inf->state = gzip_next_field(inf);
+        }
+        return true;
+    }
+
+    case S_BLOCK:
+        NEED_BITS(3);
+        inf->final = BITS(1);
+        switch ((inf->bit_buffer >> 1) & 3) {
+        case 0: inf->state = S_STORED; break;
+        case 1:
+            build_fixed_codes(inf);
+            inf->state = S_CODES;
+            break;
+        case 2: inf->state = S_DYNAMIC; break;
+        default: FAIL();
+        }
+        DROP_BITS(3);
+        return true;
+
+    case S_STORED:
+        // Stored blocks start at a byte boundary
+        DROP_BITS(inf->bit_count & 7);
+        NEED_BITS(16);
+        inf->length = BITS(16);
+        DROP_BITS(16);
+        inf->state = S_STORED_CHECK;
+        return true;
+
+    case S_STORED_CHECK:
+        NEED_BITS(16);
+        if (BITS(16) != (~inf->length & 0xffff)) FAIL();
+        DROP_BITS(16);
+        inf->state = S_STORED_COPY;
+        return true;
+
+    case S_STORED_COPY:
+        while (inf->length > 0 && !inf->stopped) {
+            NEED_BITS(8);
+            put(inf, BITS(8));
+            DROP_BITS(8);
+            inf->length--;
+        }
+        if (inf->length == 0) {
+            end_block(inf);
+        }
+        return true;
+
+    case S_DYNAMIC:
+        NEED_BITS(14);
+        inf->lit_count = BITS(5) + 257;
+        inf->length_count = inf->lit_count + ((inf->bit_buffer >> 5) & 0x1f) + 1;
+        inf->length = ((inf->bit_buffer >> 10) & 0x0f) + 4;
+        DROP_BITS(14);
+        if (inf->lit_count > 286 || inf->length_count - inf->lit_count > 30) {
+            FAIL();
+        }
+        os_memset(inf->lengths, 0, 19);
+        inf->count = 0;
+        inf->state = S_CODE_LENS;
+        return true;
+
+    case S_CODE_LENS:
+        while (inf->count < inf->length) {
+            NEED_BITS(3);
+            inf->lengths[code_length_order[inf->count++]] = BITS(3);
+            DROP_BITS(3);
+        }
+        if (!build_code(inf->dist_counts, inf->dist_symbols, inf->lengths,
+            19)) {
+            FAIL();
+        }
+        inf->count = 0;
+        inf->state = S_LENGTHS;
+        return true;
+
+    case S_LENGTHS:
+        sym = decode(inf->dist_counts, inf->dist_symbols, inf->bit_buffer,
+            inf->bit_count, &used);
+        if (sym == DECODE_NEED_BITS) return false;
+        if (sym == DECODE_INVALID) FAIL();
+        if (sym < 16) {
+            DROP_BITS(used);
+            inf->lengths[inf->count++] = sym;
+        } else {
+            // Repeat the previous length 3-6 times or zero 3-10 or 11-138
+            unsigned extra = sym == 16 ? 2 : sym == 17 ? 3 : 7;
+            NEED_BITS(used + extra);
+            unsigned repeat = (sym == 18 ? 11 : 3) +
+                ((inf->bit_buffer >> used) & ((1U << extra) - 1));
+            uint8_t len = 0;
+            if (sym == 16) {
+                if (inf->count == 0) FAIL();
+                len = inf->lengths[inf->count - 1];
+            }
+            if (inf->count + repeat > inf->length_count) FAIL();
+            DROP_BITS(used + extra);
+            while (repeat-- > 0) {
+                inf->lengths[inf->count++] = len;
+            }
+        }
+        if (inf->count == inf->length_count) {
+            // Without an end of block code the block couldn't end
+            if (inf->lengths[256] == 0 ||
+                !build_code(inf->lit_counts, inf->lit_symbols, inf->lengths,
+                    inf->lit_count) ||
+                !build_code(inf->dist_counts, inf->dist_symbols,
+                    inf->lengths + inf->lit_count,
+                    inf->length_count - inf->lit_count)) {
+                FAIL();
+            }
+            inf->state = S_CODES;
+        }
+        return true;
+
+    case S_CODES:
+        sym = decode(inf->lit_counts, inf->lit_symbols, inf->bit_buffer,
+            inf->bit_count, &used);
+        if (sym == DECODE_NEED_BITS) return false;
+        if (sym == DECODE_INVALID) FAIL();
+        DROP_BITS(used);
+        if (sym < 256) {
+            put(inf, sym);
+        } else if (sym == 256) {
+            end_block(inf);
+        } else if (sym - 257 < 29) {
+            inf->count = sym - 257;
+            inf->state = S_LENGTH_EXTRA;
+        } else {
+            FAIL();
+        }
+        return true;
+
+    case S_LENGTH_EXTRA:
+        NEED_BITS(length_extra[inf->count]);
+        inf->length = length_base[inf->count] + BITS(length_extra[inf->count]);
+        DROP_BITS(length_extra[inf->count]);
+        inf->state = S_DIST;
+        return true;
+
+    case S_DIST:
+        sym = decode(inf->dist_counts, inf->dist_symbols, inf->bit_buffer,
+            inf->bit_count, &used);
+        if (sym == DECODE_NEED_BITS) return false;
+        if (sym == DECODE_INVALID || sym >= 30) FAIL();
+        DROP_BITS(used);
+        inf->count = sym;
+        inf->state = S_DIST_EXTRA;
+        return true;
+
+    case S_DIST_EXTRA:
+        NEED_BITS(dist_extra[inf->count]);
+        if (!copy_match(inf, dist_base[inf->count] +
+            BITS(dist_extra[inf->count]))) {
+            FAIL();
+        }
+        DROP_BITS(dist_extra[inf->count]);
+        inf->state = S_CODES;
+        return true;
+
+    case S_TRAILER:
+        if (inf->format == INFLATE_FORMAT_RAW) {
+            inf->state = S_DONE;
+            return true;
+        }
+        if (inf->count == 0) {
+            // The checksum covers everything up to here
+            flush(inf);
+            DROP_BITS(inf->bit_count & 7);
+            inf->trailer = 0;
+        }
+        NEED_BITS(8);
+        check_trailer(inf, BITS(8));
+        DROP_BITS(8);
+        return true;
+    }
+    return true;
+}
+
+void inflate_init(inflate_t *inf, inflate_format_t format, uint8_t *window,
+    unsigned window_bits, inflate_output_cb output, void *arg) {
+    os_memset(inf, 0, sizeof(*inf));
+    inf->format = format;
+    inf->state = format == INFLATE_FORMAT_GZIP ? S_GZIP_HEADER :
+        format == INFLATE_FORMAT_ZLIB ? S_ZLIB_HEADER : S_BLOCK;
+    inf->window = window;
+    inf->window_size = INFLATE_WINDOW_SIZE(window_bits);
+    inf->output = output;
+    inf->arg = arg;
+}
+
+inflate_result_t inflate_stream(inflate_t *inf, const char *data, size_t len) {
+    const uint8_t *in = (const uint8_t *)data;
+    const uint8_t *end = in + len;
+
+    while (!inf->stopped && inf->state != S_DONE && inf->state != S_ERROR) {
+        while (inf->bit_count <= 24 && in < end) {
+            inf->bit_buffer |= (uint32_t)*in++ << inf->bit_count;
+            inf->bit_count += 8;
+        }
+        if (!step(inf) && in == end) break;
+    }
+    flush(inf);
+
+    if (inf->state == S_ERROR) return INFLATE_ERROR;
+    if (inf->stopped) return INFLATE_STOPPED;
+    return inf->state == S_DONE ? INFLATE_DONE : INFLATE_MORE;
+}
@@ -1,106 +1,172 @@
 #include "owmap_parser.h"
 
+#include <osapi.h>
 #include <espmissingincludes.h>
 
 #include "images/icons_32.h"
+#include "owmap_schema.h"
 
-static void start_arr(void *user_arg) {
+// A forecast is an object at the record depth on the way to a record field,
+// that is one matched by the record path. Other containers at that depth,
+// such as those inside a fully matched value, are only counted.
+static void start_object(void *user_arg) {
     weather_parser_t *parser = (weather_parser_t *)user_arg;
 
-    if (os_strcmp(parser->current_key, "list") == 0) {
-        parser->in_list = true;
-        parser->array_level = 0;
-        parser->object_level = 0;
+    if (parser->depth++ == OWMAP_RECORD_DEPTH &&
+        jsmn_stream_filter_reaches(&parser->json_parser, OWMAP_RECORD_FIELD)) {
+        os_memset(&parser->current, 0, sizeof(parser->current));
+        parser->in_record = true;
     }
-
-    parser->array_level += 1;
 }
 
-static void end_arr(void *user_arg) {
+static void start_array(void *user_arg) {
     weather_parser_t *parser = (weather_parser_t *)user_arg;
-    if (parser->in_list && (--(parser->array_level)) == 0) {
-        parser->in_list = false;
-    }
+
+    parser->depth += 1;
 }
 
-static void start_obj(void *user_arg) {
+static void end_container(void *user_arg) {
     weather_parser_t *parser = (weather_parser_t *)user_arg;
-    if (!parser->in_list) return;
 
-    if (parser->object_level == 0) {
-        parser->dt = 0;
-        parser->temp = 0.0;
-        parser->icon = ICON_NONE;
+    parser->depth -= 1;
+    if (parser->depth == OWMAP_RECORD_DEPTH && parser->in_record) {
+        parser->in_record = false;
+        if (parser->forecast_count < FORECAST_MAX_COUNT) {
+            parser->forecasts[parser->forecast_count++] = parser->current;
+            parser->done = parser->forecast_count == FORECAST_MAX_COUNT;
+        }
+    } else if (parser->depth == 0) {
+        // The whole document has been read, even if it had fewer forecasts
+        parser->done = true;
     }
-
-    parser->object_level += 1;
 }
 
-static void end_obj(void *user_arg) {
-    weather_parser_t *parser = (weather_parser_t *)user_arg;
-    if (!parser->in_list) return;
-
-    weather_t *forecasts = parser->forecasts;
-    int forecast_count = parser->forecast_count;
-    if ((--(parser->object_level)) == 0 &&
-        forecast_count < FORECAST_MAX_COUNT) {
-        forecasts[forecast_count].time = parser->dt;
-        forecasts[forecast_count].temp = parser->temp;
-        forecasts[forecast_count].icon = parser->icon;
-        parser->forecast_count += 1;
+// Anything but a 200 status means the document isn't a forecast
+static void check_status(weather_parser_t *parser, int status) {
+    if (status != 200) {
+        os_printf("Weather API error %d\n", status);
+        parser->error = true;
     }
 }
 
-static void obj_key(const char *key, size_t key_len, void *user_arg) {
-    weather_parser_t *parser = (weather_parser_t *)user_arg;
-    os_strcpy(parser->current_key, key);
+// Field of the current value, the filter path index is the field index
+static const owmap_field_t *current_field(weather_parser_t *parser) {
+    int match = jsmn_stream_filter_match(&parser->json_parser);
+    return match < 0 ? NULL : &owmap_fields[match];
+}
+
+static void *field_slot(weather_parser_t *parser, const owmap_field_t *field) {
+    return (char *)&parser->current + field->offset;
 }
 
 static void str(const char *value, size_t len, void *user_arg) {
     weather_parser_t *parser = (weather_parser_t *)user_arg;
-    if (os_strcmp(parser->current_key, "icon") == 0 &&
-        parser->icon == ICON_NONE) {
-        parser->icon = atoi(value);
+    const owmap_field_t *field = current_field(parser);
+
+    if (field == NULL) return;
+
+    switch (field->conversion) {
+        case OWMAP_CONVERT_ICON:
+            *(weather_icon_t *)field_slot(parser, field) = atoi(value);
+            break;
+        case OWMAP_CONVERT_STATUS:
+            check_status(parser, atoi(value));
+            break;
+        default:
+            break;
     }
 }
 
-static void primitive(const char *value, size_t len, void *user_arg) {
-    weather_parser_t *parser = (weather_parser_t *)user_arg;
-
-    if (os_strcmp(parser->current_key, "dt") == 0 && parser->dt == 0) {
-        parser->dt = atoi(value);
-    } else if (os_strcmp(parser->current_key, "temp") == 0 &&
-        parser->temp == 0) {
-        parser->temp = atoi(value);
-        char *point = os_strchr(value, '.');
-        if (point != NULL && point - value > len && *(point + 1) >= '5') {
-            if (value[0] == '-') parser->temp -= 1;
-            else parser->temp += 1;
+// Round mantissa * 10^exponent to the nearest integer, halves away from zero.
+// Values beyond the int32 range are clamped to +-INT32_MAX.
+static int round_decimal(int32_t mantissa, int exponent) {
+    uint32_t value = mantissa < 0 ? -(uint32_t)mantissa : (uint32_t)mantissa;
+
+    if (exponent >= 0) {
+        while (exponent-- > 0 && value != 0) {
+            if (value > INT32_MAX / 10) {
+                value = INT32_MAX;
+                break;
+            }
+            value *= 10;
+        }
+    } else {
+        // Only the first decimal matters, drop the ones after it
+        while (exponent < -1 && value != 0) {
+            value /= 10;
+            exponent++;
         }
+        value = exponent < -1 ? 0 : (value + 5) / 10;
+    }
+    return mantissa < 0 ? -(int)value : (int)value;
+}
+
+static void number(int32_t mantissa, int exponent, void *user_arg) {
+    weather_parser_t *parser = (weather_parser_t *)user_arg;
+    const owmap_field_t *field = current_field(parser);
+    if (field == NULL) return;
+
+    void *slot = field_slot(parser, field);
+    switch (field->conversion) {
+        case OWMAP_CONVERT_TIME:
+            *(time_t *)slot = round_decimal(mantissa, exponent);
+            break;
+        case OWMAP_CONVERT_INT:
+            *(int *)slot = round_decimal(mantissa, exponent);
+            break;
+        case OWMAP_CONVERT_PERCENT:
+            *(int *)slot = round_decimal(mantissa, exponent + 2);
+            break;
+        case OWMAP_CONVERT_STATUS:
+            check_status(parser, round_decimal(mantissa, exponent));
+            break;
+        default:
+            break;
     }
 }
 
+// The filter and the field table are generated from tools/owmap_schema.txt
 static jsmn_stream_callbacks_t cbs = {
-    start_arr,
-    end_arr,
-    start_obj,
-    end_obj,
-    obj_key,
+    start_array,
+    end_container,
+    start_object,
+    end_container,
+    NULL,
     str,
-    primitive
+    NULL,
+    number
 };
 
 void weather_parser_init(weather_parser_t *parser) {
-    parser->current_key[0] = '\0';
-    parser->array_level = 0;
-    parser->object_level = 0;
-    parser->in_list = false;
+    parser->depth = 0;
+    parser->in_record = false;
     parser->forecast_count = 0;
-    jsmn_stream_init(&parser->json_parser, &cbs, parser);
+    parser->done = false;
+    parser->error = false;
+    jsmn_stream_init(&parser->json_parser, &cbs, parser,
+        parser->json_buffer, sizeof(parser->json_buffer),
+        parser->json_type_stack, parser->json_levels, WEATHER_JSON_MAX_DEPTH);
+    if (jsmn_stream_set_filter(&parser->json_parser, &owmap_filter) < 0) {
+        os_printf("A schema key doesn't fit the JSON buffer\n");
+        parser->error = true;
+    }
+}
+
+weather_parse_result_t weather_stream_parse(weather_parser_t *parser,
+    const char *buf, size_t len) {
+    if (!parser->done && !parser->error &&
+        jsmn_stream_parse_buf(&parser->json_parser, buf, len) < 0) {
+        os_printf("Invalid weather JSON\n");
+        parser->error = true;
+    }
+    if (parser->error) {
+        return WEATHER_PARSE_ERROR;
+    }
+    return parser->done ? WEATHER_PARSE_DONE : WEATHER_PARSE_MORE;
 }
 
-void weather_stream_parse(weather_parser_t *parser, char c) {
-    jsmn_stream_parse(&parser->json_parser, c);
+bool weather_parse_complete(const weather_parser_t *parser) {
+    return parser->done && !parser->error && parser->forecast_count > 0;
 }
 
 unsigned char *get_weather_icon_bitmap(weather_icon_t icon) {
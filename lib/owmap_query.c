@@ -0,0 +1,42 @@
+#include "owmap_query.h"
+
+#include <osapi.h>
+#include <espmissingincludes.h>
+
+#include "owmap_parser.h"
+
+bool is_daytime(time_t time) {
+    struct tm *dt = gmtime(&time);
+    return dt->tm_hour <= DAYTIME_END && dt->tm_hour >= DAYTIME_START;
+}
+
+// Forecasts from the one at time on up to the last daytime one needed
+static int count_from(time_t time) {
+    int count = 0;
+    int daytime = 0;
+    while (daytime < DAYTIME_FORECASTS && count < FORECAST_MAX_COUNT) {
+        if (is_daytime(time)) daytime += 1;
+        time += FORECAST_INTERVAL;
+        count += 1;
+    }
+    return count;
+}
+
+int forecast_count_needed(time_t now) {
+    if (now == 0) return FORECAST_MAX_COUNT;
+    // The list starts with the forecast in progress or the next one
+    time_t in_progress = now - now % FORECAST_INTERVAL;
+    int from_current = count_from(in_progress);
+    int from_next = count_from(in_progress + FORECAST_INTERVAL);
+    return from_current > from_next ? from_current : from_next;
+}
+
+bool build_owmap_query(char *buf, size_t size, const char *city_id,
+    const char *api_key, int count, const char *units, const char *lang) {
+    int len = os_snprintf(buf, size,
+        "http://" OWMAP_HOST "/data/2.5/forecast?id=%s&appid=%s"
+        "&cnt=%d%s%s%s%s", city_id, api_key, count,
+        units[0] != '\0' ? "&units=" : "", units,
+        lang[0] != '\0' ? "&lang=" : "", lang);
+    return len > 0 && (size_t)len < size;
+}
@@ -0,0 +1,35 @@
+// Generated by tools/gen_owmap_schema.py from owmap_schema.txt, do not edit
+#include "owmap_schema.h"
+
+#include <stddef.h>
+
+const jsmn_stream_filter_t owmap_filter = {
+    {
+        // cod
+        { 0xea8dc7d9UL, "cod", 0, 3, JSMN_STREAM_SEGMENT_KEY },
+        // list[*].dt
+        { 0x0cfb5881UL, "list", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+        { 0x00000000UL, NULL, 0, 0, JSMN_STREAM_SEGMENT_ANY_INDEX },
+        { 0x4d1cb705UL, "dt", 0, 2, JSMN_STREAM_SEGMENT_KEY },
+        // list[*].main.temp
+        { 0x0cfb5881UL, "list", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+        { 0x00000000UL, NULL, 0, 0, JSMN_STREAM_SEGMENT_ANY_INDEX },
+        { 0xea90e208UL, "main", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+        { 0xc01bbfc7UL, "temp", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+        // list[*].weather[0].icon
+        { 0x0cfb5881UL, "list", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+        { 0x00000000UL, NULL, 0, 0, JSMN_STREAM_SEGMENT_ANY_INDEX },
+        { 0x36404793UL, "weather", 0, 7, JSMN_STREAM_SEGMENT_KEY },
+        { 0x00000000UL, NULL, 0, 0, JSMN_STREAM_SEGMENT_INDEX },
+        { 0xe64015f0UL, "icon", 0, 4, JSMN_STREAM_SEGMENT_KEY },
+    },
+    { 0, 1, 4, 8, 13 },
+    4
+};
+
+const owmap_field_t owmap_fields[OWMAP_FIELD_COUNT] = {
+    { 0, OWMAP_CONVERT_STATUS },
+    { offsetof(weather_t, time), OWMAP_CONVERT_TIME },
+    { offsetof(weather_t, temp), OWMAP_CONVERT_INT },
+    { offsetof(weather_t, icon), OWMAP_CONVERT_ICON }
+};
@@ -1,8 +1,21 @@
+#include "osapi.h"
 #include "user_interface.h"
 #include "lwip/err.h"
 #include "lwip/dns.h"
 
 #include "util.h"
+#include "dns_cache.h"
+
+#define RTC_CLOCK_MAGIC 0x5a5ac10c
+
+typedef struct {
+    uint32_t magic;
+    uint32_t ticks;     // RTC ticks at the last reading
+    uint64_t us;
+} rtc_clock_t;
+
+static uint8_t rtc_clock_slot;
+static rtc_clock_t rtc_clock;
 
 static void ICACHE_FLASH_ATTR dns_found(const char *name, ip_addr_t *addr,
     void *arg) {
@@ -17,7 +30,8 @@ static void ICACHE_FLASH_ATTR dns_found(const char *name, ip_addr_t *addr,
 void ICACHE_FLASH_ATTR dns_resolve(const char *hostname,
     void (*dns_callback)(uint8_t *ip)) {
     ip_addr_t addr;
-    err_t ret = dns_gethostbyname(hostname, &addr, dns_found, dns_callback);
+    err_t ret = dns_cache_gethostbyname(hostname, &addr, dns_found,
+        dns_callback);
     if (ret == ERR_OK) {
         dns_callback((uint8_t *)(&addr.addr));
     } else if (ret != ERR_INPROGRESS) {
@@ -25,6 +39,75 @@ void ICACHE_FLASH_ATTR dns_resolve(const char *hostname,
     }
 }
 
+void ICACHE_FLASH_ATTR rtc_clock_init(uint8_t slot) {
+    rtc_clock_slot = slot;
+    if (!system_rtc_mem_read(slot, &rtc_clock, sizeof(rtc_clock)) ||
+        rtc_clock.magic != RTC_CLOCK_MAGIC) {
+        // Garbage after power up
+        rtc_clock.magic = RTC_CLOCK_MAGIC;
+        rtc_clock.ticks = system_get_rtc_time();
+        rtc_clock.us = 0;
+        system_rtc_mem_write(slot, &rtc_clock, sizeof(rtc_clock));
+    }
+}
+
+uint64_t ICACHE_FLASH_ATTR rtc_clock_us(void) {
+    uint32_t ticks = system_get_rtc_time();
+    // Microseconds per tick in 12-bit fixed point, it drifts with temperature
+    uint32_t period = system_rtc_clock_cali_proc();
+
+    rtc_clock.us += ((uint64_t)(ticks - rtc_clock.ticks) * period) >> 12;
+    rtc_clock.ticks = ticks;
+    if (rtc_clock_slot != 0) {
+        system_rtc_mem_write(rtc_clock_slot, &rtc_clock, sizeof(rtc_clock));
+    }
+    return rtc_clock.us;
+}
+
+uint32_t ICACHE_FLASH_ATTR hash_update(uint32_t hash, const void *data,
+    size_t len) {
+    const uint8_t *p = data;
+    while (len-- > 0) {
+        hash = (hash ^ *p++) * 16777619UL;
+    }
+    return hash;
+}
+
+static int ICACHE_FLASH_ATTR parse_digits(const char *s, int n) {
+    int value = 0;
+    while (n-- > 0) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10 + (*s++ - '0');
+    }
+    return value;
+}
+
+time_t ICACHE_FLASH_ATTR parse_http_date(const char *date) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    // Sun, 06 Nov 1994 08:49:37 GMT
+    if (os_strlen(date) != 29 || date[3] != ',' ||
+        os_strcmp(date + 25, " GMT") != 0) {
+        return 0;
+    }
+    struct tm t;
+    os_memset(&t, 0, sizeof(t));
+    t.tm_mday = parse_digits(date + 5, 2);
+    t.tm_year = parse_digits(date + 12, 4) - 1900;
+    t.tm_hour = parse_digits(date + 17, 2);
+    t.tm_min = parse_digits(date + 20, 2);
+    t.tm_sec = parse_digits(date + 23, 2);
+    for (t.tm_mon = 0; t.tm_mon < 12; t.tm_mon++) {
+        if (os_memcmp(date + 8, months + 3 * t.tm_mon, 3) == 0) break;
+    }
+    if (t.tm_mday < 1 || t.tm_year < 70 || t.tm_hour < 0 || t.tm_min < 0 ||
+        t.tm_sec < 0 || t.tm_mon == 12) {
+        return 0;
+    }
+    // The SDK has no time zones, mktime() takes the fields as UTC
+    time_t time = mktime(&t);
+    return time == (time_t)-1 ? 0 : time;
+}
+
 //////////////////////////////////////////////////
 // Simple timezone example for ESP8266.
 // Copyright 2015 Richard A Burton
@@ -4,49 +4,177 @@
 #include <ets_sys.h>
 #include <user_interface.h>
 #include <espmissingincludes.h>
+#include "lwip/dns.h"
 
-static const uint32_t IP_POLL_INTERVAL_MS = 100;
+#include "util.h"
 
-static os_timer_t ip_check_timer;
-static uint32_t ip_time_counter_ms = 0;
+#define WIFI_CACHE_MAGIC 0x3f1ca5e1
+
+// Time to get an address with the cached settings before falling back to a
+// scan and DHCP
+static const uint32_t FAST_CONNECT_TIMEOUT_MS = 2000;
+
+// The access point and address of the last connection
+typedef struct {
+    uint32_t magic;
+    uint32_t config_hash;   // Of the SSID and password
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t unused;
+    struct ip_info ip;
+    ip_addr_t dns;
+} wifi_cache_t;
+
+// Only the deadline, the connection is noticed from the events
+static os_timer_t deadline_timer;
 static uint32_t ip_timeout_ms = 0;
 static station_connect_cb connect_cb;
+static bool connecting;         // The user hasn't been told yet
+
+static uint8_t cache_slot;
+static wifi_cache_t cache;
+static struct station_config conf;
+static bool fast_connect;       // With the cached settings
+static uint32_t connect_start;
+
+static uint32_t config_hash(void) {
+    uint32_t hash = hash_update(HASH_INIT, conf.ssid, sizeof(conf.ssid));
+    return hash_update(hash, conf.password, sizeof(conf.password));
+}
+
+static void save_cache(void) {
+    struct station_config current;
+    if (cache_slot == 0) return;
+    // The BSSID of the access point that was joined
+    wifi_station_get_config(&current);
+    os_memcpy(cache.bssid, current.bssid, sizeof(cache.bssid));
+    cache.channel = wifi_get_channel();
+    wifi_get_ip_info(STATION_IF, &cache.ip);
+    cache.dns = dns_getserver(0);
+    cache.config_hash = config_hash();
+    cache.magic = WIFI_CACHE_MAGIC;
+    system_rtc_mem_write(cache_slot, &cache, sizeof(cache));
+}
+
+// Scans for the access point and gets an address with DHCP
+static void slow_connect(void) {
+    fast_connect = false;
+    conf.bssid_set = 0;
+    wifi_station_disconnect();
+    wifi_station_set_config_current(&conf);
+    wifi_station_dhcpc_start();
+    wifi_station_connect();
+}
+
+static void arm_deadline(uint32_t timeout_ms) {
+    os_timer_disarm(&deadline_timer);
+    os_timer_arm(&deadline_timer, timeout_ms, false);
+}
+
+static void connect_done(bool connected) {
+    os_timer_disarm(&deadline_timer);
+    connecting = false;
+    connect_cb(connected);
+}
+
+static void connect_failed(void) {
+    uint32_t elapsed_ms = (system_get_time() - connect_start) / 1000;
+    if (fast_connect && elapsed_ms < ip_timeout_ms) {
+        os_printf("Cached access point failed, scanning\n");
+        wifi_station_forget();
+        slow_connect();
+        arm_deadline(ip_timeout_ms - elapsed_ms);
+    } else {
+        connect_done(false);
+    }
+}
+
+static void deadline_cb(void *args) {
+    if (connecting) {
+        connect_failed();
+    }
+}
 
-static void ip_check_cb(void *args) {
-    os_timer_disarm(&ip_check_timer);
-    ip_time_counter_ms += IP_POLL_INTERVAL_MS;
+static void event_cb(System_Event_t *event) {
+    if (!connecting) return;
 
     uint8_t connect_status = wifi_station_get_connect_status();
     struct ip_info ipconfig;
     wifi_get_ip_info(STATION_IF, &ipconfig);
 
-    if (connect_status == STATION_GOT_IP && ipconfig.ip.addr != 0) {
-        // Everything's fine, tell the user that the connection succeeded
-        connect_cb(true);
-    } else if (connect_status == STATION_WRONG_PASSWORD ||
-        connect_status == STATION_NO_AP_FOUND ||
-        connect_status == STATION_CONNECT_FAIL ||
-        ip_time_counter_ms > ip_timeout_ms) {
-        connect_cb(false);
-    } else {
-        os_timer_arm(&ip_check_timer, IP_POLL_INTERVAL_MS, false);
+    switch (event->event) {
+    case EVENT_STAMODE_CONNECTED:
+        // With a static address there may be no GOT_IP event to wait for
+    case EVENT_STAMODE_GOT_IP:
+        if (connect_status == STATION_GOT_IP && ipconfig.ip.addr != 0) {
+            // Everything's fine, tell the user that the connection succeeded
+            os_printf("Got IP in %u ms %s\n",
+                (system_get_time() - connect_start) / 1000,
+                fast_connect ? "with cached settings" : "after a scan");
+            if (!fast_connect) {
+                save_cache();
+            }
+            connect_done(true);
+        }
+        break;
+    case EVENT_STAMODE_DISCONNECTED:
+        // The SDK keeps retrying other failures until the deadline
+        if (connect_status == STATION_WRONG_PASSWORD ||
+            connect_status == STATION_NO_AP_FOUND ||
+            connect_status == STATION_CONNECT_FAIL) {
+            connect_failed();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void wifi_station_cache_init(uint8_t slot) {
+    cache_slot = slot;
+    if (!system_rtc_mem_read(slot, &cache, sizeof(cache))) {
+        cache.magic = 0;
+    }
+}
+
+void wifi_station_forget(void) {
+    cache.magic = 0;
+    if (cache_slot != 0) {
+        system_rtc_mem_write(cache_slot, &cache, sizeof(cache));
     }
 }
 
 void wifi_station_init(const char *ssid, const char *password,
     station_connect_cb user_connect_cb, uint32_t timeout_ms) {
+    connect_start = system_get_time();
     wifi_set_opmode(STATION_MODE);
-    struct station_config conf;
-    conf.bssid_set = 0;
+    os_memset(&conf, 0, sizeof(conf));
     os_memcpy(&conf.ssid, ssid, os_strlen(ssid) + 1);
     os_memcpy(&conf.password, password, os_strlen(password) + 1);
-    wifi_station_set_config(&conf);
 
-    ip_time_counter_ms = 0;
+    fast_connect = cache_slot != 0 && cache.magic == WIFI_CACHE_MAGIC &&
+        cache.config_hash == config_hash();
+    if (fast_connect) {
+        // Join the same access point on its channel without scanning and
+        // reuse the address instead of asking DHCP again
+        conf.bssid_set = 1;
+        os_memcpy(conf.bssid, cache.bssid, sizeof(conf.bssid));
+        wifi_station_set_config_current(&conf);
+        wifi_set_channel(cache.channel);
+        wifi_station_dhcpc_stop();
+        wifi_set_ip_info(STATION_IF, &cache.ip);
+        dns_setserver(0, &cache.dns);
+    } else {
+        wifi_station_set_config_current(&conf);
+        wifi_station_dhcpc_start();
+    }
+
     ip_timeout_ms = timeout_ms;
     connect_cb = user_connect_cb;
-    os_timer_disarm(&ip_check_timer);
-    os_timer_setfn(&ip_check_timer, (os_timer_func_t *)ip_check_cb, NULL);
-    os_timer_arm(&ip_check_timer, IP_POLL_INTERVAL_MS, false);
+    connecting = true;
+    wifi_set_event_handler_cb(event_cb);
+    os_timer_disarm(&deadline_timer);
+    os_timer_setfn(&deadline_timer, (os_timer_func_t *)deadline_cb, NULL);
+    arm_deadline(fast_connect && FAST_CONNECT_TIMEOUT_MS < timeout_ms ?
+        FAST_CONNECT_TIMEOUT_MS : timeout_ms);
 }
-
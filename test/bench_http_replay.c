@@ -0,0 +1,86 @@
+// Throughput of the receive path: recorded responses fed through the client
+// in full-size TCP segments, the baseline for receive path changes
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "httpclient.h"
+
+#define SEGMENT_SIZE 1460
+#define TOTAL_BYTES (256 * 1024 * 1024)
+
+static const char * const responses[] = {
+    "forecast_length.http",
+    "forecast_chunked.http",
+    "forecast_close.http",
+    "forecast_gzip.http",
+};
+
+static size_t body_bytes;
+static int disconnects;
+
+static void callback(char *body, int status, const http_header *header,
+    int size) {
+    if (status == HTTP_STATUS_BODY) {
+        body_bytes += size;
+    } else if (status == HTTP_STATUS_DISCONNECT) {
+        disconnects++;
+    }
+}
+
+static void bench(const char *name) {
+    size_t len, i, pos;
+    char *response = host_fixture(name, &len);
+    size_t runs = TOTAL_BYTES / len;
+    size_t cut_count = (len - 1) / SEGMENT_SIZE;
+    size_t *cuts = malloc((cut_count + 1) * sizeof(*cuts));
+    long allocs = 0;
+    uint64_t start, ns = 0;
+
+    for (i = 0; i < cut_count; i++) {
+        cuts[i] = (i + 1) * SEGMENT_SIZE;
+    }
+    body_bytes = 0;
+    disconnects = 0;
+    for (i = 0; i < runs; i++) {
+        host_reset();
+        http_connection *conn = http_connection_open("api.openweathermap.org",
+            80, false);
+        http_connection_request(conn, "/data/2.5/forecast?id=655195", NULL,
+            "", callback);
+        struct tcp_pcb *pcb = host_pcbs;
+        host_connect(pcb);
+        // Timed per segment, the pbuf copies of the stand-in included
+        for (pos = 0; pos <= cut_count; pos++) {
+            size_t from = pos > 0 ? cuts[pos - 1] : 0;
+            size_t to = pos < cut_count ? cuts[pos] : len;
+            start = host_now_ns();
+            host_receive(pcb, response + from, to - from, NULL, 0);
+            ns += host_now_ns() - start;
+        }
+        start = host_now_ns();
+        host_fin(pcb);
+        ns += host_now_ns() - start;
+        allocs += host_allocs;
+    }
+    if (disconnects != (int)runs) {
+        printf("%s: %d of %zu responses completed\n", name, disconnects, runs);
+        exit(1);
+    }
+    printf("%-24s %6zu bytes %3zu pbufs %8.1f MB/s %5.2f allocations/response\n",
+        name, len, cut_count + 1, (double)len * runs * 1000 / ns,
+        (double)allocs / runs);
+    free(cuts);
+    free(response);
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(responses) / sizeof(responses[0]); i++) {
+        bench(responses[i]);
+    }
+    host_reset();
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Throughput of jsmn-stream on the 40-entry forecast: jsmn_stream_parse_buf()
+// over the whole document and over TCP segments, against jsmn_stream_parse()
+// a byte at a time. make host-bench also runs it with the word at a time
+// string scan compiled out.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "jsmn_stream.h"
+#include "owmap_schema.h"
+
+#define MAX_DEPTH 8
+#define SEGMENT_SIZE 1460
+#define TOTAL_BYTES (64 * 1024 * 1024)
+#define LONG_STRINGS 16
+#define LONG_STRING_SIZE 1024
+
+static long events;
+
+static void event(void *arg) { events++; }
+
+static void value(const char *value, size_t len, void *arg) { events++; }
+
+static void number(int32_t mantissa, int exponent, void *arg) { events++; }
+
+static jsmn_stream_callbacks_t cbs = {
+    event, event, event, event, value, value, value, number
+};
+
+static jsmn_stream_parser parser;
+static char buffer[64];
+static unsigned char type_stack[JSMN_STREAM_TYPE_STACK_SIZE(MAX_DEPTH)];
+static jsmn_stream_level_t levels[MAX_DEPTH];
+
+static void start(const jsmn_stream_filter_t *filter) {
+    jsmn_stream_init(&parser, &cbs, NULL, buffer, sizeof(buffer), type_stack,
+        levels, MAX_DEPTH);
+    jsmn_stream_set_filter(&parser, filter);
+}
+
+// Parses the document in pieces of piece bytes, 0 for jsmn_stream_parse()
+static void bench(const char *doc, size_t len, const jsmn_stream_filter_t *filter,
+    size_t piece, const char *name) {
+    size_t runs = TOTAL_BYTES / len;
+    size_t i, pos;
+    uint64_t start_ns;
+    int r = 0;
+
+    events = 0;
+    start_ns = host_now_ns();
+    for (i = 0; i < runs && r >= 0; i++) {
+        start(filter);
+        if (piece == 0) {
+            for (pos = 0; pos < len && r >= 0; pos++) {
+                r = jsmn_stream_parse(&parser, doc[pos]);
+            }
+        } else {
+            for (pos = 0; pos < len && r >= 0; pos += piece) {
+                r = jsmn_stream_parse_buf(&parser, doc + pos,
+                    len - pos < piece ? len - pos : piece);
+            }
+        }
+    }
+    uint64_t ns = host_now_ns() - start_ns;
+    if (r < 0) {
+        printf("%s: error %d\n", name, r);
+        exit(1);
+    }
+    printf("%-40s %6.2f ns/byte %6.1f MB/s %5ld events\n", name,
+        (double)ns / runs / len, (double)len * runs * 1000 / ns,
+        events / (long)runs);
+}
+
+int main(void) {
+    size_t len, i;
+    char *doc = host_fixture("forecast_40.json", &len);
+
+    printf("JSMN_STREAM_SWAR %d\n", JSMN_STREAM_SWAR);
+    bench(doc, len, NULL, 0, "jsmn_stream_parse");
+    bench(doc, len, NULL, SEGMENT_SIZE, "jsmn_stream_parse_buf, segments");
+    bench(doc, len, NULL, len, "jsmn_stream_parse_buf, whole");
+    bench(doc, len, &owmap_filter, 0, "jsmn_stream_parse, filter");
+    bench(doc, len, &owmap_filter, SEGMENT_SIZE,
+        "jsmn_stream_parse_buf, segments, filter");
+    bench(doc, len, &owmap_filter, len,
+        "jsmn_stream_parse_buf, whole, filter");
+    free(doc);
+
+    // Skipped strings much longer than those of the forecast
+    doc = malloc(LONG_STRINGS * (LONG_STRING_SIZE + 8) + 16);
+    len = sprintf(doc, "{\"s\":[");
+    for (i = 0; i < LONG_STRINGS; i++) {
+        doc[len++] = '\"';
+        memset(doc + len, 'a' + i % 26, LONG_STRING_SIZE);
+        len += LONG_STRING_SIZE;
+        len += sprintf(doc + len, "\"%s", i + 1 < LONG_STRINGS ? "," : "]}");
+    }
+    bench(doc, len, &owmap_filter, len,
+        "parse_buf, 1 KB strings, filter");
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,142 @@
+// The forecast parsed with numbers decoded by jsmn-stream against the old
+// path, which had them buffered as text and converted with atoi()
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "owmap_parser.h"
+#include "owmap_schema.h"
+
+#define TOTAL_BYTES (64 * 1024 * 1024)
+// Room for the longest number of the document as text
+#define OLD_BUFFER_SIZE 32
+
+// The weather parser before numbers were decoded in jsmn-stream, with the
+// same filter and the depth-only record handling of the time
+typedef struct {
+    int depth;
+    weather_t current;
+    weather_t forecasts[FORECAST_MAX_COUNT];
+    int forecast_count;
+    int rounding_checks;        // Times the rounding condition was true
+    int temps;
+    jsmn_stream_parser json_parser;
+    char json_buffer[OLD_BUFFER_SIZE];
+    unsigned char json_type_stack[JSMN_STREAM_TYPE_STACK_SIZE(WEATHER_JSON_MAX_DEPTH)];
+    jsmn_stream_level_t json_levels[WEATHER_JSON_MAX_DEPTH];
+} old_parser_t;
+
+static void old_start_container(void *user_arg) {
+    old_parser_t *parser = (old_parser_t *)user_arg;
+
+    if (parser->depth++ == OWMAP_RECORD_DEPTH) {
+        memset(&parser->current, 0, sizeof(parser->current));
+    }
+}
+
+static void old_end_container(void *user_arg) {
+    old_parser_t *parser = (old_parser_t *)user_arg;
+
+    parser->depth -= 1;
+    if (parser->depth == OWMAP_RECORD_DEPTH &&
+        parser->forecast_count < FORECAST_MAX_COUNT) {
+        parser->forecasts[parser->forecast_count++] = parser->current;
+    }
+}
+
+static void old_str(const char *value, size_t len, void *user_arg) {
+    old_parser_t *parser = (old_parser_t *)user_arg;
+    int match = jsmn_stream_filter_match(&parser->json_parser);
+
+    if (match >= 0 && owmap_fields[match].conversion == OWMAP_CONVERT_ICON) {
+        parser->current.icon = atoi(value);
+    }
+}
+
+static void old_primitive(const char *value, size_t len, void *user_arg) {
+    old_parser_t *parser = (old_parser_t *)user_arg;
+    int match = jsmn_stream_filter_match(&parser->json_parser);
+    if (match < 0) return;
+
+    switch (owmap_fields[match].conversion) {
+        case OWMAP_CONVERT_TIME:
+            parser->current.time = atoi(value);
+            break;
+        case OWMAP_CONVERT_INT: {
+            parser->current.temp = atoi(value);
+            char *point = strchr(value, '.');
+            if (point != NULL && point - value > len && *(point + 1) >= '5') {
+                parser->rounding_checks++;
+                if (value[0] == '-') parser->current.temp -= 1;
+                else parser->current.temp += 1;
+            }
+            parser->temps++;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static jsmn_stream_callbacks_t old_cbs = {
+    old_start_container,
+    old_end_container,
+    old_start_container,
+    old_end_container,
+    NULL,
+    old_str,
+    old_primitive
+};
+
+static void old_parse(old_parser_t *parser, const char *doc, size_t len) {
+    parser->depth = 0;
+    parser->forecast_count = 0;
+    jsmn_stream_init(&parser->json_parser, &old_cbs, parser,
+        parser->json_buffer, sizeof(parser->json_buffer),
+        parser->json_type_stack, parser->json_levels, WEATHER_JSON_MAX_DEPTH);
+    jsmn_stream_set_filter(&parser->json_parser, &owmap_filter);
+    jsmn_stream_parse_buf(&parser->json_parser, doc, len);
+}
+
+static weather_parser_t wparser;
+static old_parser_t old;
+
+int main(void) {
+    size_t len, i;
+    char *doc = host_fixture("forecast_40.json", &len);
+    size_t runs = TOTAL_BYTES / len;
+    uint64_t start, new_ns, old_ns;
+    int differ = 0;
+
+    start = host_now_ns();
+    for (i = 0; i < runs; i++) {
+        weather_parser_init(&wparser);
+        weather_stream_parse(&wparser, doc, len);
+    }
+    new_ns = host_now_ns() - start;
+
+    start = host_now_ns();
+    for (i = 0; i < runs; i++) {
+        old.rounding_checks = 0;
+        old.temps = 0;
+        old_parse(&old, doc, len);
+    }
+    old_ns = host_now_ns() - start;
+
+    if (!weather_parse_complete(&wparser) ||
+        old.forecast_count != wparser.forecast_count) {
+        printf("The parsers disagree on the forecasts\n");
+        return 1;
+    }
+    for (i = 0; i < (size_t)wparser.forecast_count; i++) {
+        differ += old.forecasts[i].temp != wparser.forecasts[i].temp;
+    }
+    printf("number_callback %6.2f ns/byte\n", (double)new_ns / runs / len);
+    printf("atoi            %6.2f ns/byte\n", (double)old_ns / runs / len);
+    printf("atoi rounding check true for %d of %d temperatures, %d of the "
+        "first %d forecasts now round differently\n", old.rounding_checks,
+        old.temps, differ, wparser.forecast_count);
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,305 @@
+#include "test.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mem.h>
+#include <osapi.h>
+#include <user_interface.h>
+#include "lwip/dns.h"
+
+#define RTC_MEM_SLOTS 192
+
+struct tcp_pcb *host_pcbs;
+uint32_t host_time_us;
+ip_addr_t host_dns_addr;
+bool host_dns_pending;
+int host_dns_queries;
+long host_allocs;
+long host_allocs_live;
+long host_pbufs_live;
+int test_failures;
+
+static uint32_t rtc_mem[RTC_MEM_SLOTS];
+
+// The query host_dns_answer() completes
+static struct {
+    const char *hostname;
+    dns_found_callback found;
+    void *arg;
+} dns_query;
+
+int test_result(const char *name) {
+    if (test_failures > 0) {
+        printf("%s: %d checks failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+void host_reset(void) {
+    while (host_pcbs != NULL) {
+        struct tcp_pcb *pcb = host_pcbs;
+        host_pcbs = pcb->next;
+        free(pcb);
+    }
+    host_time_us = 0;
+    IP4_ADDR(&host_dns_addr, 127, 0, 0, 1);
+    host_dns_pending = false;
+    host_dns_queries = 0;
+    dns_query.found = NULL;
+    host_allocs = 0;
+    host_allocs_live = 0;
+    host_pbufs_live = 0;
+}
+
+int host_printf(const char *fmt, ...) {
+    static int verbose = -1;
+    va_list args;
+    int r;
+
+    if (verbose < 0) {
+        verbose = getenv("HOST_VERBOSE") != NULL;
+    }
+    if (!verbose) {
+        return 0;
+    }
+    va_start(args, fmt);
+    r = vprintf(fmt, args);
+    va_end(args);
+    return r;
+}
+
+void *host_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr != NULL) {
+        host_allocs++;
+        host_allocs_live++;
+    }
+    return ptr;
+}
+
+void *host_zalloc(size_t size) {
+    void *ptr = host_malloc(size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void host_free(void *ptr) {
+    if (ptr != NULL) {
+        host_allocs_live--;
+        free(ptr);
+    }
+}
+
+uint32 system_get_time(void) {
+    return host_time_us;
+}
+
+// One tick per microsecond
+uint32 system_get_rtc_time(void) {
+    return host_time_us;
+}
+
+uint32 system_rtc_clock_cali_proc(void) {
+    return 1 << 12;
+}
+
+static bool rtc_mem_range(uint8 slot, uint16 size) {
+    return size % 4 == 0 && slot + size / 4 <= RTC_MEM_SLOTS;
+}
+
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size) {
+    if (!rtc_mem_range(src_addr, load_size)) {
+        return false;
+    }
+    memcpy(des_addr, &rtc_mem[src_addr], load_size);
+    return true;
+}
+
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr,
+    uint16 save_size) {
+    if (!rtc_mem_range(des_addr, save_size)) {
+        return false;
+    }
+    memcpy(&rtc_mem[des_addr], src_addr, save_size);
+    return true;
+}
+
+// Every name resolves to 127.0.0.1 right away
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+    dns_found_callback found, void *callback_arg) {
+    host_dns_queries++;
+    if (host_dns_pending) {
+        dns_query.hostname = hostname;
+        dns_query.found = found;
+        dns_query.arg = callback_arg;
+        return ERR_INPROGRESS;
+    }
+    *addr = host_dns_addr;
+    return ERR_OK;
+}
+
+void host_dns_answer(bool found) {
+    dns_found_callback callback = dns_query.found;
+    ip_addr_t addr = host_dns_addr;
+
+    if (callback == NULL) {
+        printf("host_dns_answer: no query waiting\n");
+        test_failures++;
+        return;
+    }
+    dns_query.found = NULL;
+    callback(dns_query.hostname, found ? &addr : NULL, dns_query.arg);
+}
+
+struct tcp_pcb *tcp_new(void) {
+    struct tcp_pcb *pcb = calloc(1, sizeof(*pcb));
+    pcb->next = host_pcbs;
+    host_pcbs = pcb;
+    return pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+    pcb->arg = arg;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    pcb->recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+    pcb->sent = sent;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+    pcb->err = err;
+}
+
+err_t tcp_connect(struct tcp_pcb *pcb, ip_addr_t *ipaddr, uint16_t port,
+    tcp_connected_fn connected) {
+    pcb->remote_ip = *ipaddr;
+    pcb->remote_port = port;
+    pcb->connected = connected;
+    return ERR_OK;
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, uint16_t len,
+    uint8_t apiflags) {
+    if (pcb->closed || pcb->aborted || pcb->tx_len + len >= HOST_TX_SIZE) {
+        return ERR_MEM;
+    }
+    memcpy(pcb->tx + pcb->tx_len, dataptr, len);
+    pcb->tx_len += len;
+    pcb->tx[pcb->tx_len] = '\0';
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    return ERR_OK;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, uint16_t len) {
+    pcb->recved += len;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    pcb->closed = true;
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    pcb->aborted = true;
+}
+
+uint8_t pbuf_free(struct pbuf *p) {
+    uint8_t count = 0;
+    while (p != NULL) {
+        struct pbuf *next = p->next;
+        free(p->payload);
+        free(p);
+        host_pbufs_live--;
+        count++;
+        p = next;
+    }
+    return count;
+}
+
+err_t host_connect(struct tcp_pcb *pcb) {
+    return pcb->connected != NULL ?
+        pcb->connected(pcb->arg, pcb, ERR_OK) : ERR_OK;
+}
+
+err_t host_receive(struct tcp_pcb *pcb, const char *data, size_t len,
+    const size_t *cuts, size_t cut_count) {
+    struct pbuf *head = NULL;
+    struct pbuf **tail = &head;
+    size_t start = 0;
+    size_t i;
+
+    for (i = 0; i <= cut_count; i++) {
+        size_t end = i < cut_count ? cuts[i] : len;
+        struct pbuf *q = calloc(1, sizeof(*q));
+        q->payload = malloc(end - start > 0 ? end - start : 1);
+        memcpy(q->payload, data + start, end - start);
+        q->len = end - start;
+        q->tot_len = len - start;
+        host_pbufs_live++;
+        *tail = q;
+        tail = &q->next;
+        start = end;
+    }
+    if (pcb->recv == NULL) {
+        // lwIP drops data for a pcb without a receive callback
+        pbuf_free(head);
+        return ERR_OK;
+    }
+    return pcb->recv(pcb->arg, pcb, head, ERR_OK);
+}
+
+err_t host_fin(struct tcp_pcb *pcb) {
+    return pcb->recv != NULL ?
+        pcb->recv(pcb->arg, pcb, NULL, ERR_OK) : ERR_OK;
+}
+
+void host_error(struct tcp_pcb *pcb, err_t err) {
+    pcb->aborted = true;
+    if (pcb->err != NULL) {
+        pcb->err(pcb->arg, err);
+    }
+}
+
+char *host_fixture(const char *name, size_t *len) {
+    char path[256];
+    FILE *f;
+    char *data;
+    long size;
+
+    snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURES, name);
+    f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+        fprintf(stderr, "Can't read %s\n", path);
+        exit(2);
+    }
+    rewind(f);
+    data = malloc(size + 1);
+    if (fread(data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Can't read %s\n", path);
+        exit(2);
+    }
+    fclose(f);
+    data[size] = '\0';
+    *len = size;
+    return data;
+}
+
+uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
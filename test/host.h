@@ -0,0 +1,62 @@
+#pragma once
+
+// Host side of the SDK and lwIP calls that the firmware sources make. The
+// sources are built unchanged against the stand-in headers in test/include
+// and the tests play the network through the functions here.
+
+#include <c_types.h>
+#include "lwip/tcp.h"
+
+#define HOST_TX_SIZE 2048
+
+// A connection as the client sees it. Nothing is freed until host_reset(),
+// so the tests can look at a pcb after the client let go of it.
+struct tcp_pcb {
+    void *arg;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_err_fn err;
+    tcp_connected_fn connected;
+    ip_addr_t remote_ip;
+    uint16_t remote_port;
+    char tx[HOST_TX_SIZE];      // Everything written, null-terminated
+    size_t tx_len;
+    uint32_t recved;            // Bytes passed to tcp_recved()
+    bool closed;                // By tcp_close()
+    bool aborted;               // By tcp_abort() or host_error()
+    struct tcp_pcb *next;
+};
+
+extern struct tcp_pcb *host_pcbs;   // Newest first
+extern uint32_t host_time_us;       // Returned by system_get_time()
+extern long host_allocs;            // os_malloc() and os_zalloc() calls
+extern long host_allocs_live;       // Allocations not freed yet
+extern long host_pbufs_live;        // Received pbufs not freed yet
+
+// dns_gethostbyname() answers with host_dns_addr right away, or with
+// host_dns_pending set returns ERR_INPROGRESS and leaves the query to
+// host_dns_answer(), which reports host_dns_addr or a failure
+extern ip_addr_t host_dns_addr;
+extern bool host_dns_pending;
+extern int host_dns_queries;           // dns_gethostbyname() calls
+void host_dns_answer(bool found);
+
+// Frees the pcbs and resets the counters, the clock and DNS
+void host_reset(void);
+
+// The server side of a connection. The data of host_receive() is cut into
+// a pbuf chain at the given offsets, each pbuf in its own allocation so
+// that reads past one are caught by the address sanitizer. They return
+// what the client's callback returned, ERR_OK if there was none.
+err_t host_connect(struct tcp_pcb *pcb);
+err_t host_receive(struct tcp_pcb *pcb, const char *data, size_t len,
+    const size_t *cuts, size_t cut_count);
+err_t host_fin(struct tcp_pcb *pcb);
+// A connection error, lwIP frees the pcb before reporting it
+void host_error(struct tcp_pcb *pcb, err_t err);
+
+// Contents of a file in test/fixtures, null-terminated, free() it
+char *host_fixture(const char *name, size_t *len);
+
+// Monotonic time for the benchmarks
+uint64_t host_now_ns(void);
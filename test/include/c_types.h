@@ -0,0 +1,21 @@
+#pragma once
+
+// Stand-in for the SDK header on the host, see test/host.h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t uint8;
+typedef int8_t sint8;
+typedef uint16_t uint16;
+typedef int16_t sint16;
+typedef uint32_t uint32;
+typedef int32_t sint32;
+typedef uint64_t uint64;
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define ICACHE_RAM_ATTR
+#define LOCAL static
+#define BIT(n) (1UL << (n))
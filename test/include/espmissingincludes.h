@@ -0,0 +1,4 @@
+#pragma once
+
+// The C library declares everything on the host
+#include <c_types.h>
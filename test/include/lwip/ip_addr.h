@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+struct ip_addr {
+    uint32_t addr;
+};
+typedef struct ip_addr ip_addr_t;
+
+#define IP4_ADDR(ipaddr, a, b, c, d) \
+    (ipaddr)->addr = ((uint32_t)((d) & 0xff) << 24) | \
+                     ((uint32_t)((c) & 0xff) << 16) | \
+                     ((uint32_t)((b) & 0xff) << 8) | \
+                      (uint32_t)((a) & 0xff)
+
+#define ip4_addr1(ipaddr) (((const uint8_t *)(ipaddr))[0])
+#define ip4_addr2(ipaddr) (((const uint8_t *)(ipaddr))[1])
+#define ip4_addr3(ipaddr) (((const uint8_t *)(ipaddr))[2])
+#define ip4_addr4(ipaddr) (((const uint8_t *)(ipaddr))[3])
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) ip4_addr1(ipaddr), ip4_addr2(ipaddr), \
+    ip4_addr3(ipaddr), ip4_addr4(ipaddr)
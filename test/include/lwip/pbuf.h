@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    uint16_t tot_len;       // This and the rest of the chain
+    uint16_t len;
+};
+
+// Frees the whole chain
+uint8_t pbuf_free(struct pbuf *p);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+// Counted so that tests can check allocations per request and leaks
+#define os_malloc host_malloc
+#define os_zalloc host_zalloc
+#define os_free host_free
+
+void *host_malloc(size_t size);
+void *host_zalloc(size_t size);
+void host_free(void *ptr);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <c_types.h>
+#include <ets_sys.h>
+
+typedef ETSTimer os_timer_t;
+typedef ETSTimerFunc os_timer_func_t;
+
+#define os_memcmp memcmp
+#define os_memcpy memcpy
+#define os_memmove memmove
+#define os_memset memset
+#define os_bzero(s, n) memset(s, 0, n)
+#define os_strcmp strcmp
+#define os_strncmp strncmp
+#define os_strcpy strcpy
+#define os_strncpy strncpy
+#define os_strlen strlen
+#define os_strchr strchr
+#define os_strstr strstr
+#define os_sprintf sprintf
+#define os_snprintf snprintf
+#define os_printf host_printf
+
+// Debug output, only shown with HOST_VERBOSE set in the environment
+int host_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
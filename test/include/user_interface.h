@@ -0,0 +1,13 @@
+#pragma once
+
+#include <c_types.h>
+#include <osapi.h>
+#include "lwip/ip_addr.h"
+
+// The system calls that the host built sources use, see test/host.c
+
+uint32 system_get_time(void);
+uint32 system_get_rtc_time(void);
+uint32 system_rtc_clock_cali_proc(void);
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size);
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size);
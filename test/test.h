@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "host.h"
+
+// Failed checks are counted and reported, the test goes on. main() returns
+// test_result() so that make stops on a failing test.
+extern int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_INT(actual, expected) do { \
+    long long actual_ = (actual), expected_ = (expected); \
+    if (actual_ != expected_) { \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", \
+            __FILE__, __LINE__, #actual, actual_, expected_); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_STR(actual, expected) do { \
+    const char *actual_ = (actual), *expected_ = (expected); \
+    if (strcmp(actual_, expected_) != 0) { \
+        fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", \
+            __FILE__, __LINE__, #actual, actual_, expected_); \
+        test_failures++; \
+    } \
+} while (0)
+
+int test_result(const char *name);
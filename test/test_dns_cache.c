@@ -0,0 +1,224 @@
+// The DNS cache in RTC memory: hits, expiry with the refresh in the
+// background, replacement of the oldest entry, and forgetting an address
+// that didn't work
+
+#include <string.h>
+
+#include "test.h"
+#include "dns_cache.h"
+#include "util.h"
+#include "user_interface.h"
+
+#define RTC_CLOCK 64
+#define RTC_DNS_CACHE (RTC_CLOCK + RTC_CLOCK_SLOTS)
+#define SECOND 1000000u
+
+// The found callback of the last lookup
+static struct {
+    int calls;
+    bool found;
+    uint32_t addr;
+} answer;
+
+static void found(const char *name, ip_addr_t *addr, void *arg) {
+    answer.calls++;
+    answer.found = addr != NULL;
+    answer.addr = addr != NULL ? addr->addr : 0;
+}
+
+static uint32_t address(int d) {
+    ip_addr_t addr;
+    IP4_ADDR(&addr, 10, 0, 0, d);
+    return addr.addr;
+}
+
+static void set_dns(int d) {
+    host_dns_addr.addr = address(d);
+}
+
+// Returns the address of an answer right away, 0 if there was none
+static uint32_t lookup(const char *hostname) {
+    ip_addr_t addr = { 0 };
+
+    memset(&answer, 0, sizeof(answer));
+    err_t err = dns_cache_gethostbyname(hostname, &addr, found, NULL);
+    return err == ERR_OK ? addr.addr : 0;
+}
+
+// Power up, with the RTC memory garbage
+static void power_up(void) {
+    uint32_t garbage[RTC_CLOCK_SLOTS + DNS_CACHE_SLOTS];
+
+    memset(garbage, 0xa5, sizeof(garbage));
+    system_rtc_mem_write(RTC_CLOCK, garbage, sizeof(garbage));
+    host_reset();
+    rtc_clock_init(RTC_CLOCK);
+    dns_cache_init(RTC_DNS_CACHE);
+    set_dns(1);
+}
+
+// Waking from deep sleep, the cache comes back from RTC memory
+static void wake_up(void) {
+    rtc_clock_init(RTC_CLOCK);
+    dns_cache_init(RTC_DNS_CACHE);
+}
+
+static void test_hit(void) {
+    power_up();
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(host_dns_queries, 1);
+
+    // Kept across deep sleep, and not asked again while it is fresh
+    set_dns(2);
+    host_time_us += 10 * SECOND;
+    wake_up();
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(host_dns_queries, 1);
+    CHECK_INT(answer.calls, 0);
+}
+
+static void test_miss_in_progress(void) {
+    power_up();
+    host_dns_pending = true;
+    CHECK_INT(lookup("a.example"), 0);
+    host_dns_answer(true);
+    CHECK_INT(answer.calls, 1);
+    CHECK(answer.found && answer.addr == address(1));
+    host_dns_pending = false;
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(host_dns_queries, 1);
+
+    // A failed query reaches the caller and caches nothing
+    host_dns_pending = true;
+    CHECK_INT(lookup("b.example"), 0);
+    host_dns_answer(false);
+    CHECK_INT(answer.calls, 1);
+    CHECK(!answer.found);
+    host_dns_pending = false;
+    CHECK_INT(lookup("b.example"), address(1));
+    CHECK_INT(host_dns_queries, 3);
+    CHECK_INT(host_allocs_live, 0);
+}
+
+static void test_expiry(void) {
+    power_up();
+    CHECK_INT(lookup("a.example"), address(1));
+
+    // Still fresh a second before the TTL
+    host_time_us = (DNS_CACHE_TTL - 1) * SECOND;
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(host_dns_queries, 1);
+
+    // Expired: the old address is used and refreshed in the background
+    host_time_us = DNS_CACHE_TTL * SECOND;
+    set_dns(2);
+    host_dns_pending = true;
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(host_dns_queries, 2);
+    host_dns_answer(true);
+    CHECK_INT(answer.calls, 0);
+    CHECK_INT(lookup("a.example"), address(2));
+    CHECK_INT(host_dns_queries, 2);
+
+    // A failed refresh keeps the stale address, the next lookup tries again
+    host_time_us += DNS_CACHE_TTL * SECOND;
+    set_dns(3);
+    CHECK_INT(lookup("a.example"), address(2));
+    CHECK_INT(host_dns_queries, 3);
+    host_dns_answer(false);
+    CHECK_INT(lookup("a.example"), address(2));
+    CHECK_INT(host_dns_queries, 4);
+    host_dns_answer(true);
+    CHECK_INT(lookup("a.example"), address(3));
+    CHECK_INT(host_dns_queries, 4);
+
+    // An answer that comes right away updates the entry at once
+    host_dns_pending = false;
+    host_time_us += DNS_CACHE_TTL * SECOND;
+    set_dns(4);
+    CHECK_INT(lookup("a.example"), address(4));
+    CHECK_INT(host_dns_queries, 5);
+    CHECK_INT(host_allocs_live, 0);
+}
+
+static void test_replacement(void) {
+    static const char * const hosts[DNS_CACHE_ENTRIES + 1] = {
+        "a.example", "b.example", "c.example", "d.example", "e.example"
+    };
+    int i;
+
+    power_up();
+    for (i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        host_time_us += SECOND;
+        set_dns(1 + i);
+        CHECK_INT(lookup(hosts[i]), address(1 + i));
+    }
+    // A refresh makes a.example the newest, b.example is now the oldest
+    host_time_us += DNS_CACHE_TTL * SECOND;
+    set_dns(1);
+    CHECK_INT(lookup(hosts[0]), address(1));
+    CHECK_INT(host_dns_queries, DNS_CACHE_ENTRIES + 1);
+
+    set_dns(9);
+    CHECK_INT(lookup(hosts[DNS_CACHE_ENTRIES]), address(9));
+    wake_up();
+    host_dns_queries = 0;
+    set_dns(10);
+    CHECK_INT(lookup(hosts[0]), address(1));
+    CHECK_INT(host_dns_queries, 0);
+    CHECK_INT(lookup(hosts[DNS_CACHE_ENTRIES]), address(9));
+    CHECK_INT(host_dns_queries, 0);
+    CHECK_INT(lookup(hosts[1]), address(10));
+    CHECK_INT(host_dns_queries, 1);
+}
+
+static void test_forget(void) {
+    power_up();
+    CHECK_INT(lookup("a.example"), address(1));
+    CHECK_INT(lookup("b.example"), address(1));
+
+    // The address didn't work, the next lookup asks again even after sleep
+    set_dns(2);
+    dns_cache_forget("a.example");
+    dns_cache_forget("unknown.example");
+    wake_up();
+    CHECK_INT(lookup("a.example"), address(2));
+    CHECK_INT(host_dns_queries, 3);
+    CHECK_INT(lookup("b.example"), address(1));
+    CHECK_INT(host_dns_queries, 3);
+
+    // The freed entry is the first to be reused
+    for (int i = 0; i < DNS_CACHE_ENTRIES - 2; i++) {
+        host_time_us += SECOND;
+        char name[16];
+        snprintf(name, sizeof(name), "%c.example", 'c' + i);
+        lookup(name);
+    }
+    dns_cache_forget("c.example");
+    lookup("x.example");
+    host_dns_queries = 0;
+    CHECK_INT(lookup("a.example"), address(2));
+    CHECK_INT(lookup("b.example"), address(1));
+    CHECK_INT(lookup("d.example"), address(2));
+    CHECK_INT(host_dns_queries, 0);
+}
+
+// Without a slot the cache is off and every lookup goes to DNS
+static void test_disabled(void) {
+    host_reset();
+    dns_cache_init(0);
+    CHECK_INT(lookup("a.example"), host_dns_addr.addr);
+    CHECK_INT(lookup("a.example"), host_dns_addr.addr);
+    CHECK_INT(host_dns_queries, 2);
+    dns_cache_forget("a.example");
+}
+
+int main(void) {
+    test_hit();
+    test_miss_in_progress();
+    test_expiry();
+    test_replacement();
+    test_forget();
+    test_disabled();
+    return test_result("test_dns_cache");
+}
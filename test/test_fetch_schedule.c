@@ -0,0 +1,181 @@
+// The fetch scheduler: the interval after each result, and a simulated day
+// of upstream updates, fetches and a network outage
+
+#include <string.h>
+
+#include "test.h"
+#include "fetch_schedule.h"
+
+#define MINUTE 60
+#define HOUR 3600
+// 2017-10-04 00:00 UTC, the start of a forecast interval
+#define DAY_START 1507075200
+#define FORECAST_INTERVAL (3 * HOUR)
+// Seconds a wake takes, from the fetch to the sleep, an assumption
+#define AWAKE 4
+// Fixed interval before the scheduler, for the report
+#define FIXED_INTERVAL 300
+
+static fetch_schedule_t schedule;
+
+static uint32_t next(fetch_result_t result, uint32_t failures, time_t now,
+    time_t stale, uint32_t jitter) {
+    return fetch_schedule_next(&schedule, result, failures, now, stale, jitter);
+}
+
+static void test_intervals(void) {
+    time_t t = DAY_START + 10 * MINUTE;
+
+    // Without the time the interval is fixed and nothing is planned
+    memset(&schedule, 0, sizeof(schedule));
+    CHECK_INT(next(FETCH_UPDATED, 0, 0, 0, 0), DATA_FETCH_INTERVAL);
+    CHECK_INT(schedule.next_fetch, 0);
+    CHECK_INT(fetch_schedule_remaining(&schedule, 0), DATA_FETCH_INTERVAL);
+
+    // An update is due FORECAST_UPDATE_INTERVAL after the change, the sleep
+    // is clamped to DATA_FETCH_MAX_INTERVAL
+    memset(&schedule, 0, sizeof(schedule));
+    CHECK_INT(next(FETCH_UPDATED, 0, t, 0, 0), DATA_FETCH_MAX_INTERVAL);
+    CHECK_INT(schedule.last_change, t);
+    CHECK_INT(schedule.next_fetch, t + DATA_FETCH_MAX_INTERVAL / 1000);
+    CHECK_INT(fetch_schedule_remaining(&schedule, t + 1000),
+        DATA_FETCH_MAX_INTERVAL - 1000000);
+    CHECK_INT(fetch_schedule_remaining(&schedule, t + HOUR),
+        DATA_FETCH_INTERVAL);
+
+    // Up to the due time, not below DATA_FETCH_INTERVAL, plus the jitter
+    time_t due = t + FORECAST_UPDATE_INTERVAL;
+    CHECK_INT(next(FETCH_UNCHANGED, 0, due - 20 * MINUTE, 0, 0),
+        20 * MINUTE * 1000);
+    CHECK_INT(next(FETCH_UNCHANGED, 0, due - 20 * MINUTE, 0, 70),
+        (20 * MINUTE + 70) * 1000);
+    CHECK_INT(next(FETCH_UNCHANGED, 0, due - 1 * MINUTE, 0, 0),
+        DATA_FETCH_INTERVAL);
+    CHECK_INT(schedule.misses, 0);
+
+    // Stored forecasts going stale before the update is due come first
+    CHECK_INT(next(FETCH_UNCHANGED, 0, due - HOUR, due - 40 * MINUTE, 0),
+        20 * MINUTE * 1000);
+    CHECK_INT(next(FETCH_UNCHANGED, 0, due - HOUR, due - HOUR, 0),
+        DATA_FETCH_MAX_INTERVAL);
+
+    // An overdue update backs off to 5, 10, 20 and then 40 minutes
+    static const int backoff[] = { 5, 10, 20, 40, 40, 40 };
+    time_t now = due;
+    for (size_t i = 0; i < sizeof(backoff) / sizeof(backoff[0]); i++) {
+        uint32_t interval = next(FETCH_UNCHANGED, 0, now, 0, 0);
+        CHECK_INT(interval, backoff[i] * MINUTE * 1000);
+        CHECK_INT(schedule.misses, i + 1);
+        now += interval / 1000;
+    }
+    // With the jitter the longest backoff reaches the clamp
+    CHECK_INT(next(FETCH_UNCHANGED, 0, now, 0, 25 * MINUTE),
+        DATA_FETCH_MAX_INTERVAL);
+    // The update ends the backoff
+    CHECK_INT(next(FETCH_UPDATED, 0, now, 0, 0), DATA_FETCH_MAX_INTERVAL);
+    CHECK_INT(schedule.misses, 0);
+
+    // Failures back off on their own and leave the plan alone
+    fetch_schedule_t before = schedule;
+    CHECK_INT(next(FETCH_FAILED, 1, now + HOUR, 0, 0), 2 * DATA_FETCH_INTERVAL);
+    CHECK_INT(next(FETCH_FAILED, 2, now + HOUR, 0, 0), 4 * DATA_FETCH_INTERVAL);
+    CHECK_INT(next(FETCH_FAILED, 3, now + HOUR, 0, 0), 8 * DATA_FETCH_INTERVAL);
+    CHECK_INT(next(FETCH_FAILED, 9, now + HOUR, 0, 0), 8 * DATA_FETCH_INTERVAL);
+    CHECK(memcmp(&before, &schedule, sizeof(schedule)) == 0);
+
+    // A change seen before the clock was set doesn't count
+    schedule.last_change = now + HOUR;
+    CHECK_INT(next(FETCH_UNCHANGED, 0, now, 0, 0), DATA_FETCH_INTERVAL);
+}
+
+// Minutes after each 3-hour mark that the upstream update comes out
+static const int publish_delay[] = { 12, 35, 3, 40, 20, 0, 27, 9, 15 };
+
+static time_t published(int k) {
+    return DAY_START + k * FORECAST_INTERVAL + publish_delay[k] * MINUTE;
+}
+
+// A day from a first fetch at 00:17, with the network down from 07:00 to
+// 07:50. Returns the number of wakes.
+static int simulate_day(uint32_t jitter, int *worst_latency) {
+    time_t now = DAY_START + 17 * MINUTE;
+    time_t stale = 0;
+    int seen = -1;          // Last update fetched
+    uint32_t failures = 0;
+    int wakes = 0;
+
+    memset(&schedule, 0, sizeof(schedule));
+    *worst_latency = 0;
+    while (now < DAY_START + 24 * HOUR) {
+        fetch_result_t result;
+        int latest = (now - DAY_START) / FORECAST_INTERVAL;
+        if (now < published(latest)) latest--;
+
+        wakes++;
+        if (now >= DAY_START + 7 * HOUR && now < DAY_START + 7 * HOUR + 50 * MINUTE) {
+            result = FETCH_FAILED;
+            failures = failures < DATA_FETCH_MAX_BACKOFF ?
+                failures + 1 : DATA_FETCH_MAX_BACKOFF;
+        } else {
+            failures = 0;
+            result = latest > seen ? FETCH_UPDATED : FETCH_UNCHANGED;
+        }
+        if (result == FETCH_UPDATED) {
+            if (seen >= 0 && now - published(latest) > *worst_latency) {
+                *worst_latency = now - published(latest);
+            }
+            seen = latest;
+            // The list starts with the forecast in progress
+            stale = now - now % FORECAST_INTERVAL + FORECAST_INTERVAL;
+        }
+
+        uint32_t misses = schedule.misses;
+        uint32_t interval = next(result, failures, now, stale, jitter);
+        if (interval < DATA_FETCH_INTERVAL || interval > DATA_FETCH_MAX_INTERVAL) {
+            printf("%ld s: interval %u ms\n", (long)(now - DAY_START), interval);
+            test_failures++;
+        }
+        if (result == FETCH_FAILED) {
+            CHECK_INT(interval, DATA_FETCH_INTERVAL << failures);
+        } else if (result == FETCH_UNCHANGED &&
+            now >= (time_t)schedule.last_change + FORECAST_UPDATE_INTERVAL) {
+            uint32_t backoff = misses < DATA_FETCH_MAX_BACKOFF ?
+                misses : DATA_FETCH_MAX_BACKOFF;
+            uint32_t expected = ((DATA_FETCH_INTERVAL / 1000 << backoff) +
+                jitter) * 1000;
+            CHECK_INT(interval, expected < DATA_FETCH_MAX_INTERVAL ?
+                expected : DATA_FETCH_MAX_INTERVAL);
+        }
+        // Stored forecasts going stale are refetched without much delay
+        if (result != FETCH_FAILED && stale > now) {
+            CHECK(now + interval / 1000 <= stale + jitter ||
+                interval == DATA_FETCH_INTERVAL);
+        }
+        now += interval / 1000 + AWAKE;
+    }
+    // Every update of the day was fetched
+    CHECK_INT(seen, 7);
+    return wakes;
+}
+
+static void test_day(void) {
+    static const uint32_t jitters[] = { 0, 137, FETCH_JITTER - 1 };
+    int fixed = 24 * HOUR / (FIXED_INTERVAL + AWAKE);
+
+    for (size_t i = 0; i < sizeof(jitters) / sizeof(jitters[0]); i++) {
+        int latency;
+        int wakes = simulate_day(jitters[i], &latency);
+        // An update is seen within the longest sleep
+        CHECK(latency <= DATA_FETCH_MAX_INTERVAL / 1000 + AWAKE);
+        CHECK(wakes < fixed / 4);
+        printf("Jitter %3u s: %d wakes a day instead of %d, radio on %d s "
+            "instead of %d s, updates seen up to %d min late\n", jitters[i],
+            wakes, fixed, wakes * AWAKE, fixed * AWAKE, latency / MINUTE);
+    }
+}
+
+int main(void) {
+    test_intervals();
+    test_day();
+    return test_result("test_fetch_schedule");
+}
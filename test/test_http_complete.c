@@ -0,0 +1,281 @@
+// Completion by Content-Length or the last chunk: the request must end and
+// the pcb be closed as soon as the last byte of the response arrives, with
+// the server's FIN late or never coming. http_abort() ends it earlier.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "httpclient.h"
+#include "owmap_parser.h"
+
+// Until the server closes, as seen from behind a slow proxy
+#define FIN_DELAY_US (2 * 1000 * 1000)
+
+typedef struct {
+    const char *name;
+    const char *response;
+    bool self_delimited;    // Ends before the FIN
+} complete_case_t;
+
+static const complete_case_t cases[] = {
+    { "Content-Length, keep-alive",
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", true },
+    { "Content-Length, close",
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: close\r\n\r\n"
+      "hello", true },
+    { "chunked",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "2\r\nhe\r\n3;x=y\r\nllo\r\n0\r\n\r\n", true },
+    { "chunked with a trailer",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "5\r\nhello\r\n0\r\nExpires: 0\r\n\r\n", true },
+    { "304 without a body",
+      "HTTP/1.1 304 Not Modified\r\nContent-Length: 5\r\n\r\n", true },
+    { "no Content-Length",
+      "HTTP/1.0 200 OK\r\n\r\nhello", false },
+};
+
+static struct {
+    char body[64];
+    size_t body_len;
+    int disconnects;
+    uint32_t disconnect_time;
+} got;
+
+static void callback(char *body, int status, const http_header *header,
+    int size) {
+    if (status == HTTP_STATUS_BODY) {
+        memcpy(got.body + got.body_len, body, size);
+        got.body_len += size;
+    } else if (status == HTTP_STATUS_DISCONNECT) {
+        got.disconnects++;
+        got.disconnect_time = host_time_us;
+    }
+}
+
+static struct tcp_pcb *start(void) {
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/", NULL, "", callback);
+    host_connect(host_pcbs);
+    return host_pcbs;
+}
+
+static const char *expected_body(const complete_case_t *c) {
+    return strstr(c->response, " 304 ") != NULL ? "" : "hello";
+}
+
+// The last byte comes in its own pbuf, the request must end with it
+static void test_last_byte(const complete_case_t *c) {
+    size_t len = strlen(c->response);
+    size_t cut;
+
+    for (cut = 1; cut < len; cut++) {
+        int failures = test_failures;
+        struct tcp_pcb *pcb = start();
+        host_receive(pcb, c->response, cut, NULL, 0);
+        CHECK_INT(got.disconnects, 0);
+        CHECK(!pcb->closed);
+        host_receive(pcb, c->response + cut, len - cut, NULL, 0);
+        if (c->self_delimited) {
+            CHECK_INT(got.disconnects, 1);
+            CHECK(pcb->closed && !pcb->aborted);
+            CHECK(pcb->recv == NULL);
+            // Nothing is left waiting for the FIN that may never come
+            CHECK_INT(host_allocs_live, 0);
+            CHECK_INT(host_pbufs_live, 0);
+            CHECK_INT(pcb->recved, len);
+        } else {
+            CHECK_INT(got.disconnects, 0);
+            host_fin(pcb);
+            CHECK_INT(got.disconnects, 1);
+            CHECK_INT(host_allocs_live, 0);
+        }
+        CHECK_STR(got.body, expected_body(c));
+        if (test_failures != failures) {
+            printf("%s: cut at %zu\n", c->name, cut);
+            return;
+        }
+    }
+}
+
+// The response, anything the server sends after it, then the late FIN. The
+// time saved is what the radio would have stayed on waiting for the FIN.
+static void test_late_fin(const complete_case_t *c) {
+    struct tcp_pcb *pcb = start();
+    uint32_t received;
+
+    host_time_us = 300 * 1000;
+    host_receive(pcb, c->response, strlen(c->response), NULL, 0);
+    received = host_time_us;
+    if (c->self_delimited) {
+        host_receive(pcb, "HTTP/1.1 500", 12, NULL, 0);
+    }
+    host_time_us += FIN_DELAY_US;
+    host_fin(pcb);
+    CHECK_INT(got.disconnects, 1);
+    CHECK_STR(got.body, expected_body(c));
+    CHECK_INT(host_allocs_live, 0);
+    CHECK_INT(host_pbufs_live, 0);
+    if (c->self_delimited) {
+        CHECK_INT(got.disconnect_time, received);
+    }
+    printf("%-26s done %4u ms after the last byte, FIN after %u ms\n", c->name,
+        (got.disconnect_time - received) / 1000, FIN_DELAY_US / 1000);
+}
+
+// http_abort() from the callback of the first of two queued requests, with
+// the status or after a part of the body
+static struct {
+    int abort_after;        // Body callbacks before aborting, -1 with the status
+    int bodies;
+    int statuses;
+    int disconnects;
+    int after_disconnect;   // Callbacks after the disconnect
+} aborted;
+
+static void abort_callback(char *body, int status, const http_header *header,
+    int size) {
+    if (aborted.disconnects > 0) {
+        aborted.after_disconnect++;
+    }
+    if (status == HTTP_STATUS_DISCONNECT) {
+        aborted.disconnects++;
+    } else if (status == HTTP_STATUS_BODY) {
+        if (aborted.bodies++ == aborted.abort_after) {
+            http_abort();
+        }
+    } else if (status > 0) {
+        aborted.statuses++;
+        if (aborted.abort_after < 0) {
+            http_abort();
+        }
+    }
+}
+
+static void test_abort(int abort_after) {
+    static const char response[] =
+        "HTTP/1.1 200 OK\r\nContent-Length: 15\r\n\r\n";
+
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    memset(&aborted, 0, sizeof(aborted));
+    aborted.abort_after = abort_after;
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/a", NULL, "", abort_callback);
+    http_connection_request(conn, "/b", NULL, "", callback);
+    struct tcp_pcb *first = host_pcbs;
+    host_connect(first);
+    host_receive(first, response, strlen(response), NULL, 0);
+    host_receive(first, "hello", 5, NULL, 0);
+    if (!first->aborted) {
+        host_receive(first, "hello", 5, NULL, 0);
+    }
+
+    CHECK(first->aborted && !first->closed);
+    CHECK(first->recv == NULL);
+    CHECK_INT(aborted.statuses, 1);
+    CHECK_INT(aborted.disconnects, 1);
+    CHECK_INT(aborted.after_disconnect, 0);
+    CHECK_INT(aborted.bodies, abort_after + 1);
+    CHECK_INT(host_pbufs_live, 0);
+
+    // The queued request goes out on a new connection
+    struct tcp_pcb *second = host_pcbs;
+    CHECK(second != first);
+    if (second == first) return;
+    host_connect(second);
+    CHECK(strstr(second->tx, "GET /b HTTP/1.1\r\n") == second->tx);
+    host_receive(second, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello",
+        43, NULL, 0);
+    CHECK_STR(got.body, "hello");
+    CHECK_INT(got.disconnects, 1);
+    CHECK(second->closed);
+    CHECK_INT(aborted.disconnects, 1);
+    CHECK_INT(host_allocs_live, 0);
+}
+
+// The forecast download as the firmware does it, aborted once the parser has
+// FORECAST_MAX_COUNT forecasts, against reading it to the end and the FIN.
+// The segments come at an assumed link rate, the time is what the radio
+// stays on for the response.
+#define LINK_BYTES_PER_SECOND (1000000 / 8)
+#define SEGMENT_SIZE 1460
+
+static weather_parser_t wparser;
+static bool abort_when_parsed;
+
+static void forecast_callback(char *body, int status, const http_header *header,
+    int size) {
+    if (status == HTTP_STATUS_BODY) {
+        if (weather_stream_parse(&wparser, body, size) != WEATHER_PARSE_MORE &&
+            abort_when_parsed) {
+            http_abort();
+        }
+    } else if (status == HTTP_STATUS_DISCONNECT) {
+        got.disconnects++;
+        got.disconnect_time = host_time_us;
+    }
+}
+
+static uint32_t fetch_forecast(const char *response, size_t len, bool abort,
+    size_t *received) {
+    size_t pos;
+
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    weather_parser_init(&wparser);
+    abort_when_parsed = abort;
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/", NULL, "", forecast_callback);
+    struct tcp_pcb *pcb = host_pcbs;
+    host_connect(pcb);
+    for (pos = 0; pos < len && !pcb->aborted; pos += SEGMENT_SIZE) {
+        size_t n = len - pos < SEGMENT_SIZE ? len - pos : SEGMENT_SIZE;
+        host_time_us += (uint64_t)n * 1000000 / LINK_BYTES_PER_SECOND;
+        host_receive(pcb, response + pos, n, NULL, 0);
+        *received = pos + n;
+    }
+    if (!pcb->aborted) {
+        host_time_us += FIN_DELAY_US;
+        host_fin(pcb);
+    }
+    CHECK_INT(got.disconnects, 1);
+    CHECK(weather_parse_complete(&wparser));
+    CHECK_INT(wparser.forecast_count, FORECAST_MAX_COUNT);
+    CHECK_INT(host_allocs_live, 0);
+    return got.disconnect_time;
+}
+
+static void test_abort_saving(void) {
+    size_t len, full_bytes, abort_bytes;
+    char *response = host_fixture("forecast_close.http", &len);
+    uint32_t full = fetch_forecast(response, len, false, &full_bytes);
+    uint32_t early = fetch_forecast(response, len, true, &abort_bytes);
+
+    CHECK(abort_bytes < full_bytes);
+    printf("forecast_40, close: aborted after %zu of %zu bytes, radio on "
+        "%u ms instead of %u ms at %d kbit/s and a %u ms FIN\n", abort_bytes,
+        full_bytes, early / 1000, full / 1000, LINK_BYTES_PER_SECOND * 8 / 1000,
+        FIN_DELAY_US / 1000);
+    free(response);
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_last_byte(&cases[i]);
+        test_late_fin(&cases[i]);
+    }
+    test_abort(-1);
+    test_abort(0);
+    test_abort_saving();
+    host_reset();
+    return test_result("test_http_complete");
+}
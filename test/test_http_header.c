@@ -0,0 +1,251 @@
+// Header tokenizer: responses cut into three pbufs at every pair of offsets
+// must parse into the same http_header
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "httpclient.h"
+
+typedef struct {
+    const char *response;
+    int status;             // 0 for a malformed header
+    int content_length;
+    bool chunked;
+    bool keep_alive;
+    const char *date;
+    const char *etag;
+    const char *last_modified;
+    const char *content_encoding;
+} header_case_t;
+
+static const header_case_t cases[] = {
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Server: openresty\r\n"
+        "Date: Wed, 04 Oct 2017 08:53:11 GMT\r\n"
+        "Content-Type: application/json; charset=utf-8\r\n"
+        "Content-Length: 2\r\n"
+        "Connection: keep-alive\r\n"
+        "ETag: \"5a1f-55b0e3\"\r\n"
+        "Last-Modified: Wed, 04 Oct 2017 08:00:00 GMT\r\n"
+        "Content-Encoding: gzip\r\n"
+        "\r\n"
+        "{}",
+        200, 2, false, true, "Wed, 04 Oct 2017 08:53:11 GMT",
+        "\"5a1f-55b0e3\"", "Wed, 04 Oct 2017 08:00:00 GMT", "gzip"
+    },
+    // Lowercase names, bare LF, no space after the colon, trailing space
+    {
+        "HTTP/1.1 304 Not Modified\n"
+        "date:Wed, 04 Oct 2017 08:53:11 GMT  \n"
+        "etag:\t W/\"x\"\t\n"
+        "last-modified: Wed, 04 Oct 2017 08:00:00 GMT\n"
+        "connection: Close\n"
+        "\n",
+        304, -1, false, false, "Wed, 04 Oct 2017 08:53:11 GMT",
+        "W/\"x\"", "Wed, 04 Oct 2017 08:00:00 GMT", ""
+    },
+    // Uppercase names, chunked last in the list, no reason phrase
+    {
+        "HTTP/1.1 200\r\n"
+        "TRANSFER-ENCODING: gzip, Chunked\r\n"
+        "CONTENT-ENCODING: GZIP\r\n"
+        "CONNECTION: Keep-Alive\r\n"
+        "\r\n"
+        "0\r\n\r\n",
+        200, -1, true, true, "", "", "", "GZIP"
+    },
+    // Chunked not last, close not last
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked, gzip\r\n"
+        "Connection: close, upgrade\r\n"
+        "Connection: closed\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "", "", "", ""
+    },
+    // Whole elements only, whitespace only around them
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: xchunked\r\n"
+        "Connection: xclose\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "", "", "", ""
+    },
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chun ked\r\n"
+        "Connection: clo se\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "", "", "", ""
+    },
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunkedx\r\n"
+        "Connection: close x\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "", "", "", ""
+    },
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: gzip,x chunked\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "", "", "", ""
+    },
+    // Space around the elements, an empty last element
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: gzip ,\t chunked \t, \r\n"
+        "Connection: keep-alive,close,\r\n"
+        "\r\n"
+        "0\r\n\r\n",
+        200, -1, true, false, "", "", "", ""
+    },
+    // HTTP/1.0 closes after the response
+    {
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, false, "", "", "", ""
+    },
+    // Names that share a prefix with a parsed one, invalid lengths
+    {
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Lengthy: 5\r\n"
+        "Content-Type: text/plain\r\n"
+        "X-Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+        "Dates: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+        "Etag2: \"y\"\r\n"
+        "Content-Length: 12a\r\n"
+        "\r\n",
+        404, -1, false, true, "", "", "", ""
+    },
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length:\r\n"
+        "\r\n",
+        200, -1, false, true, "", "", "", ""
+    },
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 99999999999\r\n"
+        "\r\n",
+        200, -1, false, true, "", "", "", ""
+    },
+    // Folded lines aren't supported and skipped, long values are truncated
+    {
+        "HTTP/1.1 200 OK\r\n"
+        "Date: Wed, 04 Oct 2017 08:53:11 GMT\r\n"
+        " continued\r\n"
+        "ETag: \"0123456789012345678901234567890123456789012345678901\"\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n",
+        200, 0, false, true, "Wed, 04 Oct 2017 08:53:11 GMT",
+        "\"0123456789012345678901234567890123456789012345", "", ""
+    },
+    // Malformed status lines
+    { "HTTP/2 200 OK\r\n\r\n" },
+    { "HTTQ/1.1 200 OK\r\n\r\n" },
+    { "HTTP/1.1 20 OK\r\n\r\n" },
+    { "HTTP/1.1 2000 OK\r\n\r\n" },
+    { "HTTP/1.1 OK\r\n\r\n" },
+};
+
+static struct {
+    http_header header;
+    int headers;
+    int disconnects;
+} got;
+
+static void callback(char *body, int status, const http_header *header,
+    int size) {
+    if (status == HTTP_STATUS_DISCONNECT) {
+        got.disconnects++;
+    } else if (status > 0) {
+        got.header = *header;
+        got.headers++;
+    }
+}
+
+static bool run(const header_case_t *c, const size_t *cuts,
+    size_t cut_count) {
+    size_t len = strlen(c->response);
+    int failures = test_failures;
+    struct tcp_pcb *pcb;
+
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/", NULL, "", callback);
+    pcb = host_pcbs;
+    host_connect(pcb);
+    host_receive(pcb, c->response, len, cuts, cut_count);
+    host_fin(pcb);
+
+    CHECK_INT(got.disconnects, 1);
+    CHECK_INT(host_allocs_live, 0);
+    CHECK_INT(host_pbufs_live, 0);
+    if (c->status == 0) {
+        CHECK_INT(got.headers, 0);
+        CHECK(pcb->aborted);
+        return test_failures == failures;
+    }
+    CHECK_INT(got.headers, 1);
+    CHECK_INT(got.header.status, c->status);
+    CHECK_INT(got.header.content_length, c->content_length);
+    CHECK_INT(got.header.chunked, c->chunked);
+    CHECK_INT(got.header.keep_alive, c->keep_alive);
+    CHECK_STR(got.header.date, c->date);
+    CHECK_STR(got.header.etag, c->etag);
+    CHECK_STR(got.header.last_modified, c->last_modified);
+    CHECK_STR(got.header.content_encoding, c->content_encoding);
+    return test_failures == failures;
+}
+
+static void test_case(const header_case_t *c) {
+    size_t len = strlen(c->response);
+    size_t cuts[2];
+    size_t i, j;
+
+    if (!run(c, NULL, 0)) {
+        printf("%.16s...: in one piece\n", c->response);
+        return;
+    }
+    for (i = 1; i < len; i++) {
+        for (j = i; j < len; j++) {
+            cuts[0] = i;
+            cuts[1] = j;
+            // The first cut alone when they are at the same offset
+            if (!run(c, cuts, i == j ? 1 : 2)) {
+                printf("%.16s...: cut at %zu and %zu\n", c->response, i, j);
+                return;
+            }
+        }
+    }
+
+    size_t *all = malloc(len * sizeof(*all));
+    for (i = 1; i < len; i++) {
+        all[i - 1] = i;
+    }
+    if (!run(c, all, len - 1)) {
+        printf("%.16s...: a byte per pbuf\n", c->response);
+    }
+    free(all);
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_case(&cases[i]);
+    }
+    host_reset();
+    return test_result("test_http_header");
+}
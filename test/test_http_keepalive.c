@@ -0,0 +1,237 @@
+// Keep-alive connections: a stand-in server answers queued requests one at a
+// time and may close the connection between them
+
+#include <string.h>
+
+#include "test.h"
+#include "httpclient.h"
+
+#define KEEP_ALIVE "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n"
+#define CLOSE "HTTP/1.1 200 OK\r\nContent-Length: 1\r\nConnection: close\r\n\r\n"
+#define HTTP_1_0 "HTTP/1.0 200 OK\r\nContent-Length: 1\r\n\r\n"
+#define CHUNKED "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" \
+    "1\r\nb\r\n0\r\n\r\n"
+
+// What each request's callback got, in the order the requests were queued
+static struct {
+    int status;
+    char body[16];
+    int disconnects;
+    int errors;
+} got[3];
+static int order[8];
+static int order_count;
+
+#define DEFINE_CALLBACK(n) \
+    static void callback_##n(char *body, int status, \
+        const http_header *header, int size) { \
+        record(n, body, status, size); \
+    }
+
+static void record(int n, char *body, int status, int size) {
+    if (status == HTTP_STATUS_BODY) {
+        strncat(got[n].body, body, size);
+    } else if (status == HTTP_STATUS_DISCONNECT) {
+        got[n].disconnects++;
+        order[order_count++] = n;
+    } else if (status == HTTP_STATUS_GENERIC_ERROR) {
+        got[n].errors++;
+    } else {
+        got[n].status = status;
+    }
+}
+
+DEFINE_CALLBACK(0)
+DEFINE_CALLBACK(1)
+DEFINE_CALLBACK(2)
+
+static http_connection *start(void) {
+    host_reset();
+    memset(got, 0, sizeof(got));
+    order_count = 0;
+    return http_connection_open("api.openweathermap.org", 80, false);
+}
+
+static int pcb_count(void) {
+    struct tcp_pcb *pcb;
+    int count = 0;
+    for (pcb = host_pcbs; pcb != NULL; pcb = pcb->next) {
+        count++;
+    }
+    return count;
+}
+
+// Requests of a pcb in the order they were written
+static int count_requests(const struct tcp_pcb *pcb) {
+    const char *p = pcb->tx;
+    int count = 0;
+    while ((p = strstr(p, "HTTP/1.1\r\n")) != NULL) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+static void send_response(struct tcp_pcb *pcb, const char *response,
+    const char *body) {
+    host_receive(pcb, response, strlen(response), NULL, 0);
+    if (body != NULL) {
+        host_receive(pcb, body, strlen(body), NULL, 0);
+    }
+}
+
+static void check_done(int requests) {
+    int i;
+    for (i = 0; i < requests; i++) {
+        CHECK_INT(got[i].disconnects, 1);
+        CHECK_INT(order[i], i);
+    }
+    CHECK_INT(host_allocs_live, 0);
+    CHECK_INT(host_pbufs_live, 0);
+}
+
+// Two requests go out on one connection, the second after the first response
+static void test_two_requests(void) {
+    http_connection *conn = start();
+    http_connection_request(conn, "/a", NULL, "", callback_0);
+    http_connection_request(conn, "/b", NULL, "", callback_1);
+    struct tcp_pcb *pcb = host_pcbs;
+    host_connect(pcb);
+
+    CHECK(strstr(pcb->tx, "GET /a HTTP/1.1\r\n") == pcb->tx);
+    CHECK(strstr(pcb->tx, "Connection: keep-alive\r\n") != NULL);
+    CHECK_INT(count_requests(pcb), 1);
+    send_response(pcb, KEEP_ALIVE, "a");
+    CHECK_INT(got[0].disconnects, 1);
+    CHECK(!pcb->closed);
+    CHECK_INT(count_requests(pcb), 2);
+    CHECK(strstr(pcb->tx, "GET /b HTTP/1.1\r\n") != NULL);
+    send_response(pcb, CHUNKED, NULL);
+
+    CHECK_INT(pcb_count(), 1);
+    CHECK(pcb->closed && !pcb->aborted);
+    CHECK_INT(got[0].status, 200);
+    CHECK_STR(got[0].body, "a");
+    CHECK_INT(got[1].status, 200);
+    CHECK_STR(got[1].body, "b");
+    // The connection and one block per request
+    CHECK_INT(host_allocs, 3);
+    check_done(2);
+}
+
+// A request queued from the callback of the previous one
+static http_connection *queue_conn;
+
+static void queue_next(char *body, int status, const http_header *header,
+    int size) {
+    record(0, body, status, size);
+    if (status == HTTP_STATUS_DISCONNECT) {
+        http_connection_request(queue_conn, "/b", NULL, "", callback_1);
+    }
+}
+
+static void test_queue_from_callback(void) {
+    queue_conn = start();
+    http_connection_request(queue_conn, "/a", NULL, "", queue_next);
+    struct tcp_pcb *pcb = host_pcbs;
+    host_connect(pcb);
+    send_response(pcb, KEEP_ALIVE, "a");
+    CHECK_INT(count_requests(pcb), 2);
+    send_response(pcb, KEEP_ALIVE, "b");
+    CHECK_INT(pcb_count(), 1);
+    CHECK(pcb->closed);
+    CHECK_STR(got[1].body, "b");
+    check_done(2);
+}
+
+// The server closes the idle connection just as the next request goes out,
+// the request is sent again on a new connection
+static void test_closed_between(bool reset) {
+    http_connection *conn = start();
+    http_connection_request(conn, "/a", NULL, "", callback_0);
+    http_connection_request(conn, "/b", NULL, "", callback_1);
+    struct tcp_pcb *first = host_pcbs;
+    host_connect(first);
+    send_response(first, KEEP_ALIVE, "a");
+    if (reset) {
+        host_error(first, ERR_RST);
+    } else {
+        host_fin(first);
+        CHECK(first->closed);
+    }
+    CHECK_INT(got[1].disconnects, 0);
+
+    struct tcp_pcb *second = host_pcbs;
+    CHECK_INT(pcb_count(), 2);
+    CHECK(second != first);
+    host_connect(second);
+    CHECK(strstr(second->tx, "GET /b HTTP/1.1\r\n") == second->tx);
+    send_response(second, KEEP_ALIVE, "b");
+    CHECK(second->closed);
+    CHECK_INT(got[1].status, 200);
+    CHECK_STR(got[1].body, "b");
+    check_done(2);
+}
+
+// Once part of a response arrived, or for a POST, a broken connection ends
+// the request instead of sending it again
+static void test_not_retried(bool post) {
+    http_connection *conn = start();
+    http_connection_request(conn, "/a", NULL, "", callback_0);
+    http_connection_request(conn, "/b", post ? "x=1" : NULL, "", callback_1);
+    http_connection_request(conn, "/c", NULL, "", callback_2);
+    struct tcp_pcb *first = host_pcbs;
+    host_connect(first);
+    send_response(first, KEEP_ALIVE, "a");
+    if (!post) {
+        host_receive(first, "HTTP/1.1 2", 10, NULL, 0);
+    }
+    host_fin(first);
+    CHECK_INT(got[1].disconnects, 1);
+    CHECK_INT(got[1].status, 0);
+
+    // The next one still goes out on a new connection
+    struct tcp_pcb *second = host_pcbs;
+    CHECK_INT(pcb_count(), 2);
+    host_connect(second);
+    CHECK(strstr(second->tx, "GET /c HTTP/1.1\r\n") == second->tx);
+    send_response(second, KEEP_ALIVE, "c");
+    CHECK_STR(got[2].body, "c");
+    check_done(3);
+}
+
+// Responses that close the connection make the next request reconnect
+static void test_close_response(const char *response) {
+    http_connection *conn = start();
+    http_connection_request(conn, "/a", NULL, "", callback_0);
+    http_connection_request(conn, "/b", NULL, "", callback_1);
+    struct tcp_pcb *first = host_pcbs;
+    host_connect(first);
+    send_response(first, response, "a");
+    CHECK(first->closed);
+    CHECK_INT(count_requests(first), 1);
+    CHECK_INT(pcb_count(), 2);
+
+    struct tcp_pcb *second = host_pcbs;
+    host_connect(second);
+    CHECK(strstr(second->tx, "GET /b HTTP/1.1\r\n") == second->tx);
+    send_response(second, response, "b");
+    CHECK(second->closed);
+    CHECK_INT(pcb_count(), 2);
+    CHECK_STR(got[0].body, "a");
+    CHECK_STR(got[1].body, "b");
+    check_done(2);
+}
+
+int main(void) {
+    test_two_requests();
+    test_queue_from_callback();
+    test_closed_between(false);
+    test_closed_between(true);
+    test_not_retried(false);
+    test_not_retried(true);
+    test_close_response(CLOSE);
+    test_close_response(HTTP_1_0);
+    host_reset();
+    return test_result("test_http_keepalive");
+}
@@ -0,0 +1,309 @@
+// Replays recorded responses through the client with the pbuf boundaries at
+// every byte and checks that the callbacks get exactly the body, or that
+// malformed chunk framing is rejected
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "httpclient.h"
+
+#define SEGMENT_SIZE 1460
+
+typedef struct {
+    const char *response;
+    const char *body;
+} replay_case_t;
+
+static const replay_case_t cases[] = {
+    { "forecast_length.http", "forecast_40.json" },
+    { "forecast_chunked.http", "forecast_40.json" },
+    { "forecast_close.http", "forecast_40.json" },
+    { "forecast_gzip.http", "forecast_40.gz" },
+};
+
+// Chunk framing written out, a NULL body for a response that must be rejected
+typedef struct {
+    const char *name;
+    const char *response;
+    const char *body;
+} framing_case_t;
+
+#define CHUNKED_HEADER "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+
+static const framing_case_t framing_cases[] = {
+    { "extensions, bare LF, trailer", CHUNKED_HEADER
+      "5;name=value;a-long-extension=\"0123456789012345678901234567890123456789"
+      "01234567890123456789\"\r\nhello\r\n"
+      "6 ; x\nworld!\n"
+      "A\r\n0123456789\r\n"
+      "0\r\nExpires: 0\r\nX-Trailer: y\r\n\r\n",
+      "helloworld!0123456789" },
+    { "uppercase and leading zero hex", CHUNKED_HEADER
+      "0000b\r\nhello world\r\n00\r\n\r\n", "hello world" },
+    { "size beyond INT_MAX", CHUNKED_HEADER
+      "80000000\r\nhello\r\n0\r\n\r\n", NULL },
+    { "overlong size", CHUNKED_HEADER
+      "000000000000000000000000000000000000000000000000100000000\r\n", NULL },
+    { "missing CRLF after the data", CHUNKED_HEADER
+      "5\r\nhelloX\r\n0\r\n\r\n", NULL },
+    { "data longer than the size", CHUNKED_HEADER
+      "3\r\nhello\r\n0\r\n\r\n", NULL },
+    { "bad hex", CHUNKED_HEADER "5g\r\nhello\r\n0\r\n\r\n", NULL },
+    { "no size", CHUNKED_HEADER "\r\nhello\r\n0\r\n\r\n", NULL },
+    { "extension without a size", CHUNKED_HEADER
+      ";x=1\r\nhello\r\n0\r\n\r\n", NULL },
+    { "sign in the size", CHUNKED_HEADER "+5\r\nhello\r\n0\r\n\r\n", NULL },
+};
+
+static struct {
+    char body[32768];
+    size_t body_len;
+    int status;
+    int headers;
+    int disconnects;
+    int errors;
+    http_timing header_timing;      // As passed with the status
+    http_timing timing;             // As passed with the disconnect
+} got;
+
+static void callback(char *body, int status, const http_header *header,
+    int size) {
+    if (status == HTTP_STATUS_BODY) {
+        if (got.body_len + size <= sizeof(got.body)) {
+            memcpy(got.body + got.body_len, body, size);
+        }
+        got.body_len += size;
+    } else if (status == HTTP_STATUS_DISCONNECT) {
+        got.disconnects++;
+        got.timing = header->timing;
+    } else if (status == HTTP_STATUS_GENERIC_ERROR) {
+        got.errors++;
+    } else {
+        got.status = status;
+        got.headers++;
+        got.header_timing = header->timing;
+    }
+}
+
+// One request whose response arrives cut at the offsets. The pieces come in
+// one pbuf chain or in a callback each, then the server closes.
+static struct tcp_pcb *replay(const char *response, size_t len,
+    const size_t *cuts, size_t cut_count, bool chained) {
+    struct tcp_pcb *pcb;
+    size_t start = 0;
+    size_t i;
+
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/data/2.5/forecast?id=655195", NULL, "",
+        callback);
+    pcb = host_pcbs;
+    host_connect(pcb);
+
+    if (chained) {
+        host_receive(pcb, response, len, cuts, cut_count);
+    } else {
+        for (i = 0; i <= cut_count; i++) {
+            size_t end = i < cut_count ? cuts[i] : len;
+            host_receive(pcb, response + start, end - start, NULL, 0);
+            start = end;
+        }
+    }
+    host_fin(pcb);
+    return pcb;
+}
+
+static bool check_replay(const replay_case_t *c, struct tcp_pcb *pcb,
+    const char *body, size_t body_len) {
+    int failures = test_failures;
+
+    CHECK_INT(got.status, 200);
+    CHECK_INT(got.headers, 1);
+    CHECK_INT(got.disconnects, 1);
+    CHECK_INT(got.errors, 0);
+    CHECK_INT(got.body_len, body_len);
+    CHECK(got.body_len == body_len && memcmp(got.body, body, body_len) == 0);
+    // The connection block and the request block
+    CHECK_INT(host_allocs, 2);
+    CHECK_INT(host_allocs_live, 0);
+    CHECK_INT(host_pbufs_live, 0);
+    CHECK(pcb->closed && !pcb->aborted);
+    return test_failures == failures;
+}
+
+static void test_splits(const replay_case_t *c) {
+    size_t len, body_len;
+    char *response = host_fixture(c->response, &len);
+    char *body = host_fixture(c->body, &body_len);
+    size_t cuts[2];
+    size_t i, j;
+    int chained;
+
+    // Two pieces, cut at every byte
+    for (chained = 0; chained < 2; chained++) {
+        for (i = 1; i < len; i++) {
+            cuts[0] = i;
+            struct tcp_pcb *pcb = replay(response, len, cuts, 1, chained);
+            if (!check_replay(c, pcb, body, body_len)) {
+                printf("%s: cut at %zu%s\n", c->response, i,
+                    chained ? ", chained" : "");
+                break;
+            }
+        }
+    }
+
+    // Three pieces, the header and the start of the body cut everywhere
+    for (i = 1; i < 512; i++) {
+        for (j = i + 1; j < 1024; j += 7) {
+            cuts[0] = i;
+            cuts[1] = j;
+            struct tcp_pcb *pcb = replay(response, len, cuts, 2, false);
+            if (!check_replay(c, pcb, body, body_len)) {
+                printf("%s: cut at %zu and %zu\n", c->response, i, j);
+                i = 512;
+                break;
+            }
+        }
+    }
+
+    // A byte per pbuf, in one chain and one at a time
+    size_t *all = malloc(len * sizeof(*all));
+    for (i = 1; i < len; i++) {
+        all[i - 1] = i;
+    }
+    for (chained = 0; chained < 2; chained++) {
+        struct tcp_pcb *pcb = replay(response, len, all, len - 1, chained);
+        if (!check_replay(c, pcb, body, body_len)) {
+            printf("%s: a byte per pbuf%s\n", c->response,
+                chained ? ", chained" : "");
+        }
+    }
+
+    printf("%s: %zu bytes, %zu byte body, %ld allocations per response\n",
+        c->response, len, body_len, host_allocs);
+    free(all);
+    free(response);
+    free(body);
+}
+
+static bool check_framing(const framing_case_t *c, struct tcp_pcb *pcb) {
+    int failures = test_failures;
+
+    CHECK_INT(got.status, 200);
+    CHECK_INT(got.disconnects, 1);
+    CHECK_INT(host_allocs_live, 0);
+    CHECK_INT(host_pbufs_live, 0);
+    if (c->body != NULL) {
+        CHECK_INT(got.body_len, strlen(c->body));
+        got.body[got.body_len] = '\0';
+        CHECK_STR(got.body, c->body);
+        CHECK(pcb->closed && !pcb->aborted);
+    } else {
+        CHECK(pcb->aborted);
+    }
+    return test_failures == failures;
+}
+
+// The framing cut at every pair of offsets, in a chain and one at a time
+static void test_framing(const framing_case_t *c) {
+    size_t len = strlen(c->response);
+    size_t cuts[2];
+    size_t i, j;
+    int chained;
+
+    for (chained = 0; chained < 2; chained++) {
+        for (i = 1; i < len; i++) {
+            for (j = i; j < len; j++) {
+                cuts[0] = i;
+                cuts[1] = j;
+                struct tcp_pcb *pcb = replay(c->response, len, cuts,
+                    i == j ? 1 : 2, chained);
+                if (!check_framing(c, pcb)) {
+                    printf("%s: cut at %zu and %zu%s\n", c->name, i, j,
+                        chained ? ", chained" : "");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// The chunked response arrives in pieces 1 ms apart: part of the status
+// line, the rest of the header, the first chunk size line, then the body in
+// full segments. Each phase must be stamped with the time of its piece.
+static void test_timing(void) {
+    size_t len, header_len, size_line_len, i;
+    char *response = host_fixture("forecast_chunked.http", &len);
+    size_t cuts[16];
+    size_t cut_count = 0;
+    uint32_t times[16];
+
+    header_len = strstr(response, "\r\n\r\n") + 4 - response;
+    size_line_len = strstr(response + header_len, "\r\n") + 2 - response;
+    cuts[cut_count++] = 20;
+    cuts[cut_count++] = header_len;
+    cuts[cut_count++] = size_line_len;
+    while (cuts[cut_count - 1] + SEGMENT_SIZE < len) {
+        cuts[cut_count] = cuts[cut_count - 1] + SEGMENT_SIZE;
+        cut_count++;
+    }
+
+    host_reset();
+    memset(&got, 0, sizeof(got));
+    host_time_us = 1000;
+    http_connection *conn = http_connection_open("api.openweathermap.org", 80,
+        false);
+    http_connection_request(conn, "/data/2.5/forecast?id=655195", NULL, "",
+        callback);
+    struct tcp_pcb *pcb = host_pcbs;
+    host_time_us = 5000;
+    host_connect(pcb);
+    for (i = 0; i <= cut_count; i++) {
+        size_t from = i > 0 ? cuts[i - 1] : 0;
+        size_t to = i < cut_count ? cuts[i] : len;
+        host_time_us = 10000 + i * 1000;
+        times[i] = host_time_us;
+        host_receive(pcb, response + from, to - from, NULL, 0);
+    }
+
+    const http_timing *t = &got.timing;
+    CHECK_INT(got.disconnects, 1);
+    CHECK_INT(t->dns_start, 1000);
+    CHECK_INT(t->dns_end, 1000);
+    CHECK_INT(t->connected, 5000);
+    CHECK_INT(t->request_sent, 5000);
+    CHECK_INT(t->first_byte, times[0]);
+    CHECK_INT(t->header_done, times[1]);
+    CHECK_INT(t->first_body_byte, times[3]);
+    CHECK_INT(t->last_byte, times[cut_count]);
+    CHECK_INT(t->bytes, len);
+    CHECK_INT(t->pbufs, cut_count + 1);
+    CHECK(t->dns_start <= t->dns_end && t->dns_end <= t->connected &&
+        t->connected <= t->request_sent && t->request_sent <= t->first_byte &&
+        t->first_byte <= t->header_done &&
+        t->header_done <= t->first_body_byte &&
+        t->first_body_byte <= t->last_byte);
+    // The header callback sees the phases up to the header
+    CHECK_INT(got.header_timing.header_done, times[1]);
+    CHECK_INT(got.header_timing.first_body_byte, 0);
+    CHECK_INT(got.header_timing.bytes, header_len);
+    CHECK_INT(got.header_timing.pbufs, 2);
+    free(response);
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_splits(&cases[i]);
+    }
+    for (i = 0; i < sizeof(framing_cases) / sizeof(framing_cases[0]); i++) {
+        test_framing(&framing_cases[i]);
+    }
+    test_timing();
+    host_reset();
+    return test_result("test_http_replay");
+}
@@ -0,0 +1,260 @@
+// Streaming inflate against zlib output: the forecast fixtures in raw deflate,
+// zlib and gzip framing, fed in random pieces and corrupted
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "inflate.h"
+#include "owmap_parser.h"
+
+#define OUTPUT_SIZE 32768
+#define RANDOM_SPLITS 2000
+// Effective TCP throughput of the station while the response comes in, an
+// assumption for the wake time estimate and not a measurement
+#define LINK_BYTES_PER_SECOND (1000000 / 8)
+#define SEGMENT_SIZE 1460
+// GZIP_WINDOW_BITS of the firmware
+#define FIRMWARE_WINDOW_BITS 12
+
+typedef struct {
+    const char *name;
+    inflate_format_t format;
+    bool checked;       // Has a CRC or Adler-32 trailer
+} encoded_t;
+
+static const encoded_t encodings[] = {
+    { "deflate", INFLATE_FORMAT_RAW, false },
+    { "zz", INFLATE_FORMAT_ZLIB, true },
+    { "gz", INFLATE_FORMAT_GZIP, true },
+    // Servers that send deflate without the zlib wrapper
+    { "deflate", INFLATE_FORMAT_ZLIB, false },
+};
+
+static const int counts[] = { 8, 40 };
+
+static struct {
+    char data[OUTPUT_SIZE];
+    size_t len;
+    size_t stop_at;     // Ask to stop once this much came out, 0 never
+} out;
+
+static inflate_t inf;
+static uint8_t window[INFLATE_WINDOW_SIZE(INFLATE_WINDOW_BITS_MAX)];
+
+static bool output(const char *data, size_t len, void *arg) {
+    if (out.len + len <= sizeof(out.data)) {
+        memcpy(out.data + out.len, data, len);
+    }
+    out.len += len;
+    return out.stop_at == 0 || out.len < out.stop_at;
+}
+
+static void start(inflate_format_t format, unsigned window_bits) {
+    memset(&out, 0, sizeof(out));
+    inflate_init(&inf, format, window, window_bits, output, NULL);
+}
+
+// Feeds the data in pieces ending at the cuts, returns the last result
+static inflate_result_t feed(const char *data, size_t len,
+    const size_t *cuts, size_t cut_count) {
+    inflate_result_t result = INFLATE_MORE;
+    size_t start = 0;
+    size_t i;
+
+    for (i = 0; i <= cut_count && result == INFLATE_MORE; i++) {
+        size_t end = i < cut_count ? cuts[i] : len;
+        result = inflate_stream(&inf, data + start, end - start);
+        start = end;
+    }
+    return result;
+}
+
+static bool decoded(const char *json, size_t json_len) {
+    return out.len == json_len && memcmp(out.data, json, json_len) == 0;
+}
+
+static int compare_size(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void test_splits(const encoded_t *e, const char *z, size_t z_len,
+    const char *json, size_t json_len) {
+    size_t cuts[16];
+    size_t i, j;
+
+    // Whole, then cut in two at every byte
+    for (i = 0; i < z_len; i++) {
+        start(e->format, INFLATE_WINDOW_BITS_MAX);
+        cuts[0] = i;
+        if (feed(z, z_len, cuts, i > 0) != INFLATE_DONE ||
+            !decoded(json, json_len)) {
+            printf("%s: cut at %zu\n", e->name, i);
+            test_failures++;
+            return;
+        }
+    }
+
+    // Random pieces
+    for (i = 0; i < RANDOM_SPLITS; i++) {
+        size_t count = 1 + rand() % 16;
+        for (j = 0; j < count; j++) {
+            cuts[j] = rand() % (z_len + 1);
+        }
+        qsort(cuts, count, sizeof(cuts[0]), compare_size);
+        start(e->format, INFLATE_WINDOW_BITS_MAX);
+        if (feed(z, z_len, cuts, count) != INFLATE_DONE ||
+            !decoded(json, json_len)) {
+            printf("%s: random cuts, run %zu\n", e->name, i);
+            test_failures++;
+            return;
+        }
+    }
+
+    // A byte at a time, with the output stopped half way
+    start(e->format, INFLATE_WINDOW_BITS_MAX);
+    out.stop_at = json_len / 2;
+    inflate_result_t result = INFLATE_MORE;
+    for (i = 0; i < z_len && result == INFLATE_MORE; i++) {
+        result = inflate_stream(&inf, z + i, 1);
+    }
+    CHECK_INT(result, INFLATE_STOPPED);
+    CHECK(out.len >= json_len / 2 && out.len < json_len);
+    CHECK(memcmp(out.data, json, json_len / 2) == 0);
+}
+
+// Corrupt data must never decode into something else and pass the check.
+// Raw deflate has no check, there the output may differ but must not
+// overrun anything.
+static void test_corrupt(const encoded_t *e, const char *z, size_t z_len,
+    const char *json, size_t json_len) {
+    char *bad = malloc(z_len);
+    size_t i;
+    int bit;
+
+    for (i = 0; i < z_len; i++) {
+        for (bit = 0; bit < 8; bit += 3) {
+            memcpy(bad, z, z_len);
+            bad[i] ^= 1 << bit;
+            start(e->format, INFLATE_WINDOW_BITS_MAX);
+            inflate_result_t result = feed(bad, z_len, NULL, 0);
+            if (e->checked && result == INFLATE_DONE &&
+                !decoded(json, json_len)) {
+                printf("%s: bit %d of byte %zu flipped\n", e->name, bit, i);
+                test_failures++;
+                free(bad);
+                return;
+            }
+        }
+    }
+
+    // Truncated data never ends
+    for (i = 0; i + 1 < z_len; i += 7) {
+        start(e->format, INFLATE_WINDOW_BITS_MAX);
+        if (feed(z, i, NULL, 0) == INFLATE_DONE) {
+            printf("%s: done after %zu of %zu bytes\n", e->name, i, z_len);
+            test_failures++;
+            break;
+        }
+    }
+    free(bad);
+}
+
+// A window smaller than the compressor's either works or fails cleanly
+static void test_windows(const encoded_t *e, const char *z, size_t z_len,
+    const char *json, size_t json_len) {
+    unsigned bits;
+
+    for (bits = INFLATE_WINDOW_BITS_MIN; bits <= INFLATE_WINDOW_BITS_MAX;
+        bits++) {
+        start(e->format, bits);
+        inflate_result_t result = feed(z, z_len, NULL, 0);
+        CHECK(result == INFLATE_ERROR ||
+            (result == INFLATE_DONE && decoded(json, json_len)));
+    }
+}
+
+static weather_parser_t wparser;
+
+static bool parse_body(const char *data, size_t len, void *arg) {
+    return weather_stream_parse(&wparser, data, len) == WEATHER_PARSE_MORE;
+}
+
+// The gzip forecast through the firmware's window and into the parser, which
+// stops the decoder once the first FORECAST_MAX_COUNT forecasts are in
+static void test_firmware_window(int count) {
+    char name[64];
+    size_t gz_len;
+    size_t i;
+
+    snprintf(name, sizeof(name), "forecast_%d.gz", count);
+    char *gz = host_fixture(name, &gz_len);
+    for (i = 0; i < gz_len; i++) {
+        size_t cut = i;
+        weather_parser_init(&wparser);
+        inflate_init(&inf, INFLATE_FORMAT_GZIP, window, FIRMWARE_WINDOW_BITS,
+            parse_body, NULL);
+        inflate_result_t result = feed(gz, gz_len, &cut, i > 0);
+        if ((result != INFLATE_STOPPED && result != INFLATE_DONE) ||
+            !weather_parse_complete(&wparser) ||
+            wparser.forecast_count != FORECAST_MAX_COUNT) {
+            printf("%s: %u-bit window, cut at %zu\n", name,
+                FIRMWARE_WINDOW_BITS, i);
+            test_failures++;
+            break;
+        }
+    }
+    free(gz);
+}
+
+static size_t segments(size_t bytes) {
+    return (bytes + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+}
+
+// What compression saves on the fetch of a full forecast response
+static void report(void) {
+    size_t plain_len, gzip_len;
+    char *plain = host_fixture("forecast_chunked.http", &plain_len);
+    char *gzip = host_fixture("forecast_gzip.http", &gzip_len);
+
+    printf("forecast_40 response: %zu bytes in %zu segments, gzip %zu bytes "
+        "in %zu segments, %zu%% less radio data\n", plain_len,
+        segments(plain_len), gzip_len, segments(gzip_len),
+        100 - gzip_len * 100 / plain_len);
+    printf("At %d kbit/s the response comes in %zu ms instead of %zu ms\n",
+        LINK_BYTES_PER_SECOND * 8 / 1000,
+        gzip_len * 1000 / LINK_BYTES_PER_SECOND,
+        plain_len * 1000 / LINK_BYTES_PER_SECOND);
+    free(plain);
+    free(gzip);
+}
+
+int main(void) {
+    char name[64];
+    size_t i, j;
+
+    srand(1);
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        size_t json_len;
+        snprintf(name, sizeof(name), "forecast_%d.json", counts[i]);
+        char *json = host_fixture(name, &json_len);
+        for (j = 0; j < sizeof(encodings) / sizeof(encodings[0]); j++) {
+            const encoded_t *e = &encodings[j];
+            size_t z_len;
+            snprintf(name, sizeof(name), "forecast_%d.%s", counts[i], e->name);
+            char *z = host_fixture(name, &z_len);
+            test_splits(e, z, z_len, json, json_len);
+            test_corrupt(e, z, z_len, json, json_len);
+            test_windows(e, z, z_len, json, json_len);
+            printf("%s: %zu bytes, %zu decoded, %zu%% of it\n", name, z_len,
+                json_len, z_len * 100 / json_len);
+            free(z);
+        }
+        free(json);
+    }
+    test_firmware_window(8);
+    test_firmware_window(40);
+    report();
+    return test_result("test_inflate");
+}
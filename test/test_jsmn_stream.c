@@ -0,0 +1,236 @@
+// jsmn_stream_parse_buf() against jsmn_stream_parse(): a document parsed in
+// one block, or cut in two at every byte, must give the events and the
+// result of parsing it a byte at a time
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "jsmn_stream.h"
+#include "owmap_schema.h"
+
+#define MAX_DEPTH 8
+#define BUFFER_SIZE 64
+#define LOG_SIZE (64 * 1024)
+
+static const char * const docs[] = {
+    "{\"s\":\"a\\\"b\\\\c\\u00e4\\/\\n\",\"n\":[-1.5e+3,0,1E-2,-0.25,12345678901234],"
+    "\"l\":[true,false,null],\"o\":{\"k\":{},\"a\":[[],[{}]]},"
+    "\"skip\":\"a string long enough to be scanned in whole words \\\" still\","
+    "\"list\":[{\"dt\":1,\"main\":{\"temp\":-2.5},\"weather\":[{\"icon\":\"10d\"},"
+    "{\"icon\":\"01n\"}]},{\"dt\":2e1,\"main\":{\"temp\":\"x\"}}],\"cod\":\"200\"}",
+    "  [ 1 , \"two\" ,\t{ \"three\" : 3 } ,\r\n[ ] ]  ",
+    "\"just a string\"",
+    // Errors, parsed up to the same point
+    "{\"a\":\"a string longer than the token buffer, which holds only 63 bytes and a null\"}",
+    "{\"a\":[1,2,[3,[4,[5,[6,[7,[8,[9]]]]]]]]}",
+    "{\"a\":\"\\x\"}",
+    "{\"a\":1.}",
+    "{\"a\":-}",
+    "{\"a\":1e}",
+    "{\"a\":\"\\u12g4\"}",
+};
+
+static char log_buf[LOG_SIZE];
+static size_t log_len;
+static jsmn_stream_parser parser;
+
+static void log_event(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void log_event(const char *format, ...) {
+    va_list args;
+    int match = jsmn_stream_filter_match(&parser);
+
+    if (log_len >= LOG_SIZE - 64) return;
+    va_start(args, format);
+    log_len += vsnprintf(log_buf + log_len, LOG_SIZE - log_len, format, args);
+    va_end(args);
+    log_len += snprintf(log_buf + log_len, LOG_SIZE - log_len, " @%d\n", match);
+}
+
+static void start_array(void *arg) { log_event("["); }
+static void end_array(void *arg) { log_event("]"); }
+static void start_object(void *arg) { log_event("{"); }
+static void end_object(void *arg) { log_event("}"); }
+
+static void key(const char *value, size_t len, void *arg) {
+    log_event("key %.*s", (int)len, value);
+}
+
+static void string(const char *value, size_t len, void *arg) {
+    log_event("string %.*s", (int)len, value);
+}
+
+static void primitive(const char *value, size_t len, void *arg) {
+    log_event("primitive %.*s", (int)len, value);
+}
+
+static void number(int32_t mantissa, int exponent, void *arg) {
+    log_event("number %de%d", mantissa, exponent);
+}
+
+static jsmn_stream_callbacks_t text_cbs = {
+    start_array, end_array, start_object, end_object, key, string, primitive
+};
+
+static jsmn_stream_callbacks_t number_cbs = {
+    start_array, end_array, start_object, end_object, key, string, primitive,
+    number
+};
+
+static char buffer[BUFFER_SIZE];
+static unsigned char type_stack[JSMN_STREAM_TYPE_STACK_SIZE(MAX_DEPTH)];
+static jsmn_stream_level_t levels[MAX_DEPTH];
+
+static void start(jsmn_stream_callbacks_t *cbs,
+    const jsmn_stream_filter_t *filter) {
+    jsmn_stream_init(&parser, cbs, NULL, buffer, sizeof(buffer), type_stack,
+        levels, MAX_DEPTH);
+    jsmn_stream_set_filter(&parser, filter);
+    log_len = 0;
+    log_buf[0] = '\0';
+}
+
+// Parses the pieces ending at the cuts, returns 0 or the first error
+static int parse_pieces(const char *doc, size_t len, const size_t *cuts,
+    size_t cut_count) {
+    size_t from = 0, i;
+
+    for (i = 0; i <= cut_count; i++) {
+        size_t to = i < cut_count ? cuts[i] : len;
+        int r = jsmn_stream_parse_buf(&parser, doc + from, to - from);
+        if (r < 0) return r;
+        if ((size_t)r != to - from) {
+            printf("%zu of %zu bytes consumed\n", (size_t)r, to - from);
+            test_failures++;
+        }
+        from = to;
+    }
+    return 0;
+}
+
+static void test_doc(const char *doc, jsmn_stream_callbacks_t *cbs,
+    const jsmn_stream_filter_t *filter, const char *mode) {
+    size_t len = strlen(doc);
+    char *expected;
+    int expected_r = 0;
+    size_t i;
+
+    // A byte at a time is the reference
+    start(cbs, filter);
+    for (i = 0; i < len && expected_r == 0; i++) {
+        expected_r = jsmn_stream_parse(&parser, doc[i]);
+    }
+    expected = strdup(log_buf);
+
+    for (i = 0; i <= len; i++) {
+        start(cbs, filter);
+        int r = parse_pieces(doc, len, &i, i > 0 && i < len);
+        if (r != expected_r || strcmp(log_buf, expected) != 0) {
+            printf("%.24s...: %s, cut at %zu: result %d, expected %d\n",
+                doc, mode, i, r, expected_r);
+            test_failures++;
+            break;
+        }
+    }
+    free(expected);
+}
+
+static void test_docs(const char *doc) {
+    test_doc(doc, &text_cbs, NULL, "text");
+    test_doc(doc, &number_cbs, NULL, "numbers");
+    test_doc(doc, &text_cbs, &owmap_filter, "text, filter");
+    test_doc(doc, &number_cbs, &owmap_filter, "numbers, filter");
+}
+
+static jsmn_stream_callbacks_t keyless_cbs = {
+    start_array, end_array, start_object, end_object, NULL, string, primitive
+};
+
+// "axsjbtr" has the FNV-1a hash and the length of "weather", only the text
+// tells them apart
+static void test_hash_collision(void) {
+    static const char doc[] = "{\"list\":[{\"weather\":[{\"icon\":\"10d\"}],"
+        "\"axsjbtr\":[{\"icon\":\"01d\"}]}]}";
+    static const char * const paths[] = { "axsjbtr" };
+    jsmn_stream_filter_t filter;
+
+    start(&keyless_cbs, &owmap_filter);
+    CHECK_INT(parse_pieces(doc, strlen(doc), NULL, 0), 0);
+    CHECK(strstr(log_buf, "string 10d @3") != NULL);
+    CHECK(strstr(log_buf, "01d") == NULL);
+
+    CHECK_INT(jsmn_stream_filter_compile(&filter, paths, 1), 0);
+    start(&keyless_cbs, &filter);
+    CHECK_INT(parse_pieces("{\"weather\":1,\"axsjbtr\":2}", 25, NULL, 0), 0);
+    CHECK(strstr(log_buf, "primitive 2 @0") != NULL);
+    CHECK(strstr(log_buf, "primitive 1") == NULL);
+}
+
+// Filter keys are compared in the buffer, keys longer than it are only
+// an error for the key callback
+static void test_key_buffer(void) {
+    char doc[160];
+    size_t len = snprintf(doc, sizeof(doc), "{\"%0100d\":1,\"cod\":2}", 0);
+
+    jsmn_stream_init(&parser, &keyless_cbs, NULL, buffer, 7, type_stack,
+        levels, MAX_DEPTH);
+    CHECK_INT(jsmn_stream_set_filter(&parser, &owmap_filter),
+        JSMN_STREAM_ERROR_NOMEM);
+    jsmn_stream_init(&parser, &keyless_cbs, NULL, buffer, 8, type_stack,
+        levels, MAX_DEPTH);
+    CHECK_INT(jsmn_stream_set_filter(&parser, &owmap_filter), 0);
+
+    start(&keyless_cbs, &owmap_filter);
+    CHECK_INT(parse_pieces(doc, len, NULL, 0), 0);
+    CHECK(strstr(log_buf, "primitive 2 @0") != NULL);
+    start(&text_cbs, &owmap_filter);
+    CHECK_INT(parse_pieces(doc, len, NULL, 0), JSMN_STREAM_ERROR_NOMEM);
+}
+
+// Whether each container reaches list[*].dt, in the order they start
+static char reaches[16];
+static size_t reach_count;
+
+static void reach(void *arg) {
+    if (reach_count < sizeof(reaches) - 1) {
+        reaches[reach_count++] = '0' + jsmn_stream_filter_reaches(&parser, 1);
+    }
+}
+
+static jsmn_stream_callbacks_t reach_cbs = { reach, NULL, reach, NULL };
+
+// Containers at the depth of the list elements reach the element paths only
+// through list: those inside the fully matched "cod" don't
+static void test_filter_reaches(void) {
+    static const char doc[] =
+        "{\"cod\":[{}],\"list\":[[],{\"dt\":1,\"main\":{}}],\"x\":[{}]}";
+
+    start(&reach_cbs, &owmap_filter);
+    reach_count = 0;
+    CHECK_INT(parse_pieces(doc, strlen(doc), NULL, 0), 0);
+    reaches[reach_count] = '\0';
+    CHECK_STR(reaches, "1001110");
+
+    start(&reach_cbs, NULL);
+    reach_count = 0;
+    CHECK_INT(parse_pieces(doc, strlen(doc), NULL, 0), 0);
+    reaches[reach_count] = '\0';
+    CHECK_STR(reaches, "000000000");
+}
+
+int main(void) {
+    size_t len, i;
+
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        test_docs(docs[i]);
+    }
+    char *forecast = host_fixture("forecast_8.json", &len);
+    test_docs(forecast);
+    free(forecast);
+    test_hash_collision();
+    test_key_buffer();
+    test_filter_reaches();
+    return test_result("test_jsmn_stream");
+}
@@ -0,0 +1,133 @@
+// Number conversion of the forecast parser: values in every JSON number form
+// rounded half away from zero, with the document cut at every byte
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "owmap_parser.h"
+
+typedef struct {
+    const char *dt;
+    const char *temp;
+    long long expected;     // Of the one that isn't "0"
+} number_case_t;
+
+static const number_case_t cases[] = {
+    { "0", "12", 12 },
+    { "0", "-7", -7 },
+    { "0", "-0", 0 },
+    // Halves
+    { "0", "0.5", 1 },
+    { "0", "2.5", 3 },
+    { "0", "12.5", 13 },
+    { "0", "12.49", 12 },
+    { "0", "-0.5", -1 },
+    { "0", "-2.5", -3 },
+    { "0", "-12.5", -13 },
+    { "0", "-12.49", -12 },
+    { "0", "-0.49", 0 },
+    { "0", "0.05", 0 },
+    // Many decimals, only the first one counts
+    { "0", "12.4999999999999999999", 12 },
+    { "0", "12.5000000000000000001", 13 },
+    { "0", "-3.14159265358979323846", -3 },
+    { "0", "0.000000000000000000000000000009", 0 },
+    // Exponents
+    { "0", "1E2", 100 },
+    { "0", "1.25e1", 13 },
+    { "0", "125e-1", 13 },
+    { "0", "-1.5E+0", -2 },
+    { "0", "5e-1", 1 },
+    { "0", "4.9e-1", 0 },
+    { "0", "-45e-1", -5 },
+    { "0", "0e999", 0 },
+    { "0", "1e-400", 0 },
+    // Beyond int32 the value is clamped
+    { "0", "2147483647", INT32_MAX },
+    { "0", "-2147483647", -INT32_MAX },
+    { "0", "3000000000", INT32_MAX },
+    { "0", "-99999999999", -INT32_MAX },
+    { "0", "1e10", INT32_MAX },
+    { "0", "-1e10", -INT32_MAX },
+    { "0", "1e400", INT32_MAX },
+    // Exponents beyond any short saturate instead of wrapping around
+    { "0", "1e40000", INT32_MAX },
+    { "0", "1e-40000", 0 },
+    { "0", "-1e99999", -INT32_MAX },
+    { "0", "5e-99999999999999999999", 0 },
+    { "0", "123456789012345678901234567890", INT32_MAX },
+    // Times
+    { "1507100400", "0", 1507100400 },
+    { "1.5071004e9", "0", 1507100400 },
+    // The decimal doesn't fit the int32 mantissa and is dropped
+    { "1507100400.5", "0", 1507100400 },
+    { "15071004000e-1", "0", 1507100400 },
+};
+
+static weather_parser_t wparser;
+
+static bool parse(const char *doc, size_t len, size_t cut) {
+    weather_parser_init(&wparser);
+    return weather_stream_parse(&wparser, doc, cut) != WEATHER_PARSE_ERROR &&
+        weather_stream_parse(&wparser, doc + cut, len - cut) ==
+            WEATHER_PARSE_DONE &&
+        weather_parse_complete(&wparser) && wparser.forecast_count == 1;
+}
+
+static void test_case(const number_case_t *c) {
+    char doc[256];
+    size_t len = snprintf(doc, sizeof(doc),
+        "{\"cod\":200,\"list\":[{\"dt\":%s,\"main\":{\"temp\":%s},"
+        "\"weather\":[{\"icon\":\"10d\"}]}]}", c->dt, c->temp);
+    bool is_temp = strcmp(c->dt, "0") == 0;
+    size_t cut;
+
+    for (cut = 0; cut <= len; cut++) {
+        int failures = test_failures;
+        CHECK(parse(doc, len, cut));
+        if (is_temp) {
+            CHECK_INT(wparser.forecasts[0].temp, c->expected);
+            CHECK_INT(wparser.forecasts[0].time, 0);
+        } else {
+            CHECK_INT(wparser.forecasts[0].time, c->expected);
+            CHECK_INT(wparser.forecasts[0].temp, 0);
+        }
+        CHECK_INT(wparser.forecasts[0].icon, RAIN);
+        if (test_failures != failures) {
+            printf("%s: cut at %zu\n", is_temp ? c->temp : c->dt, cut);
+            return;
+        }
+    }
+}
+
+// Every value of -200.0 to 200.0 in steps of 0.01, against integer rounding
+static void test_range(void) {
+    char doc[128];
+    int hundredths;
+
+    for (hundredths = -20000; hundredths <= 20000; hundredths++) {
+        int whole = (hundredths < 0 ? -hundredths : hundredths) / 100;
+        int fraction = (hundredths < 0 ? -hundredths : hundredths) % 100;
+        int expected = whole + (fraction >= 50);
+        size_t len = snprintf(doc, sizeof(doc),
+            "{\"cod\":200,\"list\":[{\"dt\":0,\"main\":{\"temp\":%s%d.%02d}}]}",
+            hundredths < 0 ? "-" : "", whole, fraction);
+        if (!parse(doc, len, len / 2) ||
+            wparser.forecasts[0].temp != (hundredths < 0 ? -expected : expected)) {
+            printf("%s: temp is %d\n", doc, wparser.forecasts[0].temp);
+            test_failures++;
+            return;
+        }
+    }
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        test_case(&cases[i]);
+    }
+    test_range();
+    return test_result("test_owmap_number");
+}
@@ -0,0 +1,56 @@
+// Forecast records of the weather parser: only the objects of the list start
+// a forecast, other containers at the same depth don't
+
+#include <string.h>
+
+#include "test.h"
+#include "owmap_parser.h"
+
+static weather_parser_t wparser;
+
+static weather_parse_result_t parse(const char *doc, size_t cut) {
+    size_t len = strlen(doc);
+
+    weather_parser_init(&wparser);
+    if (weather_stream_parse(&wparser, doc, cut) == WEATHER_PARSE_ERROR) {
+        return WEATHER_PARSE_ERROR;
+    }
+    return weather_stream_parse(&wparser, doc + cut, len - cut);
+}
+
+static void test_records(void) {
+    static const char doc[] =
+        "{\"cod\":[{}],\"list\":[[],[{\"dt\":9}],{\"dt\":1,\"main\":{\"temp\":2},"
+        "\"weather\":[{\"icon\":\"10d\"}]},\"x\",3,{\"dt\":4}]}";
+    size_t cut;
+
+    for (cut = 0; cut <= sizeof(doc) - 1; cut++) {
+        int failures = test_failures;
+        CHECK_INT(parse(doc, cut), WEATHER_PARSE_DONE);
+        CHECK(weather_parse_complete(&wparser));
+        CHECK_INT(wparser.forecast_count, 2);
+        CHECK_INT(wparser.forecasts[0].time, 1);
+        CHECK_INT(wparser.forecasts[0].temp, 2);
+        CHECK_INT(wparser.forecasts[0].icon, RAIN);
+        CHECK_INT(wparser.forecasts[1].time, 4);
+        CHECK_INT(wparser.forecasts[1].icon, ICON_NONE);
+        if (test_failures != failures) {
+            printf("Cut at %zu\n", cut);
+            return;
+        }
+    }
+}
+
+// A list without objects has no forecasts
+static void test_no_records(void) {
+    CHECK_INT(parse("{\"cod\":200,\"list\":[[],[[{}]],1]}", 10),
+        WEATHER_PARSE_DONE);
+    CHECK_INT(wparser.forecast_count, 0);
+    CHECK(!weather_parse_complete(&wparser));
+}
+
+int main(void) {
+    test_records();
+    test_no_records();
+    return test_result("test_owmap_parser");
+}
@@ -0,0 +1,123 @@
+// The forecast query: the count asked for covers the daytime forecasts the
+// display shows at any time of day, and the URL fits or is refused
+
+#include <string.h>
+
+#include "test.h"
+#include "owmap_parser.h"
+#include "owmap_query.h"
+
+#define HOUR 3600
+// 2017-10-04 00:00 UTC
+#define DAY_START 1507075200
+
+typedef struct {
+    int hour;
+    int minute;
+    int count;
+} count_case_t;
+
+// Daytime forecasts are those for 9, 12, 15 and 18 UTC. The list may start
+// with the forecast in progress or the next one.
+static const count_case_t count_cases[] = {
+    { 0, 0, 6 },        // 00 03 06 09 12 15
+    { 2, 59, 6 },
+    { 3, 0, 5 },        // 03 06 09 12 15
+    { 9, 0, 3 },        // 09 12 15, 12 15 18
+    { 10, 30, 3 },
+    { 12, 0, 7 },       // 15 18 21 00 03 06 09
+    { 15, 0, 7 },       // 15 18 21 00 03 06 09, 18 21 00 03 06 09 12
+    { 17, 59, 7 },
+    { 18, 0, 7 },       // 21 00 03 06 09 12 15
+    { 21, 0, 7 },       // 21 00 03 06 09 12 15
+    { 23, 59, 7 },
+};
+
+static void test_count_cases(void) {
+    CHECK_INT(forecast_count_needed(0), FORECAST_MAX_COUNT);
+    for (size_t i = 0; i < sizeof(count_cases) / sizeof(count_cases[0]); i++) {
+        const count_case_t *c = &count_cases[i];
+        time_t now = DAY_START + c->hour * HOUR + c->minute * 60;
+        int count = forecast_count_needed(now);
+        if (count != c->count) {
+            printf("%02d:%02d: count %d, expected %d\n", c->hour, c->minute,
+                count, c->count);
+            test_failures++;
+        }
+    }
+}
+
+// Forecasts needed from start on, searched up to the whole 5-day list
+static int needed_from(time_t start) {
+    int daytime = 0;
+    int i;
+
+    for (i = 0; i < 40; i++) {
+        daytime += is_daytime(start + i * FORECAST_INTERVAL);
+        if (daytime == DAYTIME_FORECASTS) return i + 1;
+    }
+    return 0;
+}
+
+// Every minute of a day the count is the smallest that shows
+// DAYTIME_FORECASTS forecasts wherever the list starts
+static void test_count_day(void) {
+    int total = 0;
+    int minute;
+
+    for (minute = 0; minute < 24 * 60; minute++) {
+        time_t now = DAY_START + minute * 60;
+        time_t in_progress = now - now % FORECAST_INTERVAL;
+        int from_current = needed_from(in_progress);
+        int from_next = needed_from(in_progress + FORECAST_INTERVAL);
+        int expected = from_current > from_next ? from_current : from_next;
+        int count = forecast_count_needed(now);
+
+        total += count;
+        if (expected > FORECAST_MAX_COUNT || count != expected) {
+            printf("minute %d: %d forecasts asked for, %d needed\n", minute,
+                count, expected);
+            test_failures++;
+            return;
+        }
+    }
+    printf("%.2f forecasts asked for on average instead of 40\n",
+        total / (24.0 * 60));
+}
+
+static void test_query(void) {
+    static const char full[] =
+        "http://api.openweathermap.org/data/2.5/forecast?id=655195"
+        "&appid=0123abcd&cnt=4&units=metric&lang=fi";
+    static const char bare[] =
+        "http://api.openweathermap.org/data/2.5/forecast?id=655195"
+        "&appid=0123abcd&cnt=8";
+    char buf[160];
+
+    CHECK(build_owmap_query(buf, sizeof(buf), "655195", "0123abcd", 4,
+        "metric", "fi"));
+    CHECK_STR(buf, full);
+    CHECK(build_owmap_query(buf, sizeof(buf), "655195", "0123abcd", 8, "", ""));
+    CHECK_STR(buf, bare);
+    CHECK(build_owmap_query(buf, sizeof(buf), "655195", "0123abcd", 8, "",
+        "fi"));
+    CHECK_STR(buf, "http://api.openweathermap.org/data/2.5/forecast?id=655195"
+        "&appid=0123abcd&cnt=8&lang=fi");
+
+    // Exactly fitting with the null, and a byte short
+    CHECK(build_owmap_query(buf, sizeof(full), "655195", "0123abcd", 4,
+        "metric", "fi"));
+    CHECK_STR(buf, full);
+    memset(buf, 'x', sizeof(buf));
+    CHECK(!build_owmap_query(buf, sizeof(full) - 1, "655195", "0123abcd", 4,
+        "metric", "fi"));
+    CHECK_INT(buf[sizeof(full) - 2], '\0');
+    CHECK_INT(buf[sizeof(full) - 1], 'x');
+}
+
+int main(void) {
+    test_count_cases();
+    test_count_day();
+    test_query();
+    return test_result("test_owmap_query");
+}
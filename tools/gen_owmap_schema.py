@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Generates the table driven recognizer for the forecast document.
+
+Usage: gen_owmap_schema.py <schema> <output .c> <output .h>
+
+The schema lists the values to extract, see tools/owmap_schema.txt. The output
+is a precompiled jsmn-stream filter with one path per value and a field table
+indexed by the matched path, so the parser callbacks only look up the field
+and store the converted value into the weather_t being filled. The filter
+holds the key text next to its hash, a key matches only if both agree.
+"""
+
+import os
+import re
+import sys
+
+# Limits of jsmn_stream_filter_t, see jsmn-stream/jsmn_stream.h
+MAX_PATHS = 7
+MAX_SEGMENTS = 24
+
+CONVERSIONS = {
+    'time': 'OWMAP_CONVERT_TIME',
+    'int': 'OWMAP_CONVERT_INT',
+    'percent': 'OWMAP_CONVERT_PERCENT',
+    'icon': 'OWMAP_CONVERT_ICON',
+    'status': 'OWMAP_CONVERT_STATUS',
+}
+
+
+def fail(line_number, message):
+    sys.exit('schema:%d: %s' % (line_number, message))
+
+
+def fnv1a(key):
+    h = 2166136261
+    for c in key.encode():
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h
+
+
+def c_string(key):
+    """The key as a C string literal, NULL for index segments."""
+    if key is None:
+        return 'NULL'
+    return '"%s"' % key.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def compile_path(path):
+    """Splits a path into segments like jsmn_stream_filter_compile()."""
+    segments = []
+    for token in re.findall(r'\[[^\]]*\]|[^.\[]+', path):
+        if token.startswith('['):
+            index = token[1:-1]
+            if index == '*':
+                segments.append(('JSMN_STREAM_SEGMENT_ANY_INDEX', 0, None, 0, 0))
+            elif index.isdigit() and int(index) <= 254:
+                segments.append(('JSMN_STREAM_SEGMENT_INDEX', 0, None,
+                                 int(index), 0))
+            else:
+                raise ValueError('bad index %s' % token)
+        else:
+            if len(token) > 255:
+                raise ValueError('key too long')
+            kind = 'JSMN_STREAM_SEGMENT_ANY_KEY' if token == '*' \
+                else 'JSMN_STREAM_SEGMENT_KEY'
+            segments.append((kind, fnv1a(token), token, 0, len(token)))
+    if ''.join(re.findall(r'\[[^\]]*\]|\.?[^.\[]+', path)) != path:
+        raise ValueError('bad path %s' % path)
+    return segments
+
+
+def read_schema(name):
+    record = None
+    fields = []
+    with open(name) as f:
+        for line_number, line in enumerate(f, 1):
+            words = line.split('#', 1)[0].split()
+            if not words:
+                continue
+            if words[0] == 'record' and len(words) == 2:
+                if record is not None:
+                    fail(line_number, 'more than one record')
+                record = words[1]
+            elif words[0] == 'status' and len(words) == 2:
+                fields.append((words[1], None, 'status'))
+            elif len(words) == 3:
+                if record is None:
+                    fail(line_number, 'field before the record')
+                path, member, conversion = words
+                if conversion not in CONVERSIONS or conversion == 'status':
+                    fail(line_number, 'unknown conversion %s' % conversion)
+                fields.append((record + '.' + path, member, conversion))
+            else:
+                fail(line_number, 'syntax error')
+    if record is None or all(c == 'status' for _, _, c in fields):
+        sys.exit('schema: no record or no fields')
+    if len(fields) > MAX_PATHS:
+        sys.exit('schema: more than %d fields' % MAX_PATHS)
+    return record, fields
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    schema, c_name, h_name = sys.argv[1:]
+    record, fields = read_schema(schema)
+    record_field = next(i for i, (_, _, conversion) in enumerate(fields)
+                        if conversion != 'status')
+
+    try:
+        record_depth = len(compile_path(record))
+        paths = [compile_path(path) for path, _, _ in fields]
+    except ValueError as e:
+        sys.exit('schema: %s' % e)
+    segment_count = sum(len(p) for p in paths)
+    if segment_count > MAX_SEGMENTS:
+        sys.exit('schema: more than %d path segments' % MAX_SEGMENTS)
+
+    banner = ('// Generated by tools/gen_owmap_schema.py from %s, do not edit\n'
+              % os.path.basename(schema))
+
+    with open(h_name, 'w') as h:
+        h.write(banner)
+        h.write('#pragma once\n\n')
+        h.write('#include "owmap_parser.h"\n\n')
+        h.write('// Containers enclosing a forecast: %s\n' % record)
+        h.write('#define OWMAP_RECORD_DEPTH %d\n' % record_depth)
+        h.write('// Filter path of a field inside the record\n')
+        h.write('#define OWMAP_RECORD_FIELD %d\n' % record_field)
+        h.write('#define OWMAP_FIELD_COUNT %d\n\n' % len(fields))
+        h.write('typedef enum {\n')
+        h.write(',\n'.join('    %s = %d' % (CONVERSIONS[c], i)
+                           for i, c in enumerate(CONVERSIONS)))
+        h.write('\n} owmap_conversion_t;\n\n')
+        h.write('typedef struct {\n')
+        h.write('    unsigned char offset;       // Offset of the member in weather_t\n')
+        h.write('    unsigned char conversion;   // owmap_conversion_t\n')
+        h.write('} owmap_field_t;\n\n')
+        h.write('// Filter path i is the path of field i\n')
+        h.write('extern const jsmn_stream_filter_t owmap_filter;\n')
+        h.write('extern const owmap_field_t owmap_fields[OWMAP_FIELD_COUNT];\n')
+
+    with open(c_name, 'w') as c:
+        c.write(banner)
+        c.write('#include "owmap_schema.h"\n\n')
+        c.write('#include <stddef.h>\n\n')
+        c.write('const jsmn_stream_filter_t owmap_filter = {\n')
+        c.write('    {\n')
+        for (path, _, _), segments in zip(fields, paths):
+            c.write('        // %s\n' % path)
+            for kind, key_hash, key, index, key_length in segments:
+                c.write('        { 0x%08xUL, %s, %d, %d, %s },\n'
+                        % (key_hash, c_string(key), index, key_length, kind))
+        c.write('    },\n')
+        starts = [0]
+        for segments in paths:
+            starts.append(starts[-1] + len(segments))
+        c.write('    { %s },\n' % ', '.join(str(s) for s in starts))
+        c.write('    %d\n' % len(fields))
+        c.write('};\n\n')
+        c.write('const owmap_field_t owmap_fields[OWMAP_FIELD_COUNT] = {\n')
+        c.write(',\n'.join('    { %s, %s }'
+                           % ('offsetof(weather_t, %s)' % member if member else '0',
+                              CONVERSIONS[conversion])
+                           for _, member, conversion in fields))
+        c.write('\n};\n')
+
+
+if __name__ == '__main__':
+    main()
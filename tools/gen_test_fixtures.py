@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""Generates the forecast responses that the host tests replay.
+
+Usage: gen_test_fixtures.py <output directory>
+
+The documents have the layout and field order of the OpenWeatherMap 5 day
+forecast API, compact as the API sends them, with values from a fixed seed so
+that the output doesn't change between runs. For each of a short (cnt=8) and
+a full (cnt=40) document it writes:
+
+    forecast_<cnt>.json           the body
+    forecast_<cnt>.deflate        raw deflate, zlib and gzip encodings of it,
+    forecast_<cnt>.zz             compressed like a server does, level 6 with
+    forecast_<cnt>.gz             a 32 KB window
+
+and for the full document the whole responses as received:
+
+    forecast_length.http          HTTP/1.1, Content-Length, keep-alive
+    forecast_chunked.http         HTTP/1.1, chunked in pieces of mixed sizes
+    forecast_close.http           HTTP/1.0, the body ends when the server closes
+    forecast_gzip.http            HTTP/1.1, Content-Encoding: gzip, chunked
+"""
+
+import datetime
+import json
+import os
+import random
+import sys
+import zlib
+
+START = 1507100400  # 2017-10-04 07:00:00 UTC
+STEP = 3 * 60 * 60
+
+WEATHER = [
+    (800, 'Clear', 'clear sky', '01'),
+    (801, 'Clouds', 'few clouds', '02'),
+    (802, 'Clouds', 'scattered clouds', '03'),
+    (804, 'Clouds', 'overcast clouds', '04'),
+    (500, 'Rain', 'light rain', '10'),
+    (501, 'Rain', 'moderate rain', '10'),
+    (600, 'Snow', 'light snow', '13'),
+    (701, 'Mist', 'mist', '50'),
+]
+
+DATE = 'Wed, 04 Oct 2017 08:53:11 GMT'
+
+
+def forecast(rng, index):
+    dt = START + index * STEP
+    hour = datetime.datetime.fromtimestamp(dt, datetime.timezone.utc).hour
+    pod = 'd' if 6 <= hour < 18 else 'n'
+    temp = round(rng.uniform(-12.0, 18.0), 2)
+    weather_id, main, description, icon = rng.choice(WEATHER)
+    item = {
+        'dt': dt,
+        'main': {
+            'temp': temp,
+            'temp_min': round(temp - rng.uniform(0, 1.5), 2),
+            'temp_max': temp,
+            'pressure': round(rng.uniform(990, 1030), 2),
+            'sea_level': round(rng.uniform(1000, 1040), 2),
+            'grnd_level': round(rng.uniform(990, 1030), 2),
+            'humidity': rng.randint(40, 100),
+            'temp_kf': round(rng.uniform(-1, 1), 2),
+        },
+        'weather': [{
+            'id': weather_id,
+            'main': main,
+            'description': description,
+            'icon': icon + pod,
+        }],
+        'clouds': {'all': rng.randint(0, 100)},
+        'wind': {
+            'speed': round(rng.uniform(0, 12), 2),
+            'deg': round(rng.uniform(0, 360), 3),
+        },
+    }
+    if main == 'Rain':
+        item['rain'] = {'3h': round(rng.uniform(0, 3), 3)}
+    elif main == 'Snow':
+        item['snow'] = {'3h': round(rng.uniform(0, 2), 3)}
+    item['sys'] = {'pod': pod}
+    item['dt_txt'] = datetime.datetime.fromtimestamp(
+        dt, datetime.timezone.utc).strftime('%Y-%m-%d %H:%M:%S')
+    return item
+
+
+def document(count):
+    rng = random.Random(count)
+    return {
+        'cod': '200',
+        'message': 0.0036,
+        'cnt': count,
+        'list': [forecast(rng, i) for i in range(count)],
+        'city': {
+            'id': 655195,
+            'name': 'Jyväskylä',
+            'coord': {'lat': 62.2415, 'lon': 25.7209},
+            'country': 'FI',
+        },
+    }
+
+
+def compress(data, wbits):
+    c = zlib.compressobj(6, zlib.DEFLATED, wbits)
+    return c.compress(data) + c.flush()
+
+
+def header(version, fields):
+    lines = ['HTTP/%s 200 OK' % version,
+             'Server: openresty',
+             'Date: ' + DATE,
+             'Content-Type: application/json; charset=utf-8']
+    lines += fields
+    lines += ['X-Cache-Key: /data/2.5/forecast?cnt=40&id=655195&units=metric',
+              'Access-Control-Allow-Origin: *',
+              'Access-Control-Allow-Credentials: true',
+              'Access-Control-Allow-Methods: GET, POST']
+    return ('\r\n'.join(lines) + '\r\n\r\n').encode()
+
+
+def chunked(data, rng):
+    # Servers write chunks as their buffers fill, so the sizes vary
+    out = b''
+    pos = 0
+    while pos < len(data):
+        size = min(rng.choice([1, 17, 975, 1360, 4096, 8192]), len(data) - pos)
+        digits = '%x' % size if rng.random() < 0.5 else '%X' % size
+        out += digits.encode() + b'\r\n' + data[pos:pos + size] + b'\r\n'
+        pos += size
+    return out + b'0\r\n\r\n'
+
+
+def write(directory, name, data):
+    with open(os.path.join(directory, name), 'wb') as f:
+        f.write(data)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    directory = sys.argv[1]
+
+    for count in (8, 40):
+        body = json.dumps(document(count), separators=(',', ':')).encode()
+        write(directory, 'forecast_%d.json' % count, body)
+        write(directory, 'forecast_%d.deflate' % count, compress(body, -15))
+        write(directory, 'forecast_%d.zz' % count, compress(body, 15))
+        write(directory, 'forecast_%d.gz' % count, compress(body, 31))
+
+    rng = random.Random(1)
+    write(directory, 'forecast_length.http', header('1.1', [
+        'Content-Length: %d' % len(body), 'Connection: keep-alive']) + body)
+    write(directory, 'forecast_chunked.http', header('1.1', [
+        'Transfer-Encoding: chunked', 'Connection: keep-alive']) +
+        chunked(body, rng))
+    write(directory, 'forecast_close.http', header('1.0', [
+        'Connection: close']) + body)
+    write(directory, 'forecast_gzip.http', header('1.1', [
+        'Transfer-Encoding: chunked', 'Connection: keep-alive',
+        'Content-Encoding: gzip']) + chunked(compress(body, 31), rng))
+
+
+if __name__ == '__main__':
+    main()
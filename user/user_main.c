@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <osapi.h>
 #include <ets_sys.h>
 #include <user_interface.h>
+#include <mem.h>
 #include <espmissingincludes.h>
 #include <driver/uart.h>
 
@@ -29,6 +30,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "httpclient.h"
 #include "wifi_station.h"
 #include "owmap_parser.h"
+#include "owmap_query.h"
+#include "dns_cache.h"
+#include "fetch_schedule.h"
+#include "inflate.h"
 
 #include "util.h"
 #include "credentials.h"
@@ -38,19 +43,99 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define CONNECTION_TIMEOUT 10000
 #define DATA_FETCH_TIMEOUT 10000
 #define SCREEN_TIMEOUT 20000
-#define DATA_FETCH_INTERVAL (5*60000)
+// The forecast is requested compressed if a window of 1 << GZIP_WINDOW_BITS
+// bytes can be allocated for the fetch, 0 requests it uncompressed. Servers
+// compress with a 32 KB window, so a 4 KB one decodes a response only while
+// the forecasts used come before any reference reaching back further. If
+// one doesn't decode, the fetch is repeated uncompressed right away and
+// compression stays off until power up.
+#define GZIP_WINDOW_BITS 12
 
-#define FORECAST_MAX_COUNT 8
+// Fetches whose timing is kept in RTC memory
+#define FETCH_LOG_LENGTH 4
 
 #define MAGIC_NUM 0x55aaaa55
+#define FETCH_LOG_MAGIC 0x10977a11
+#define TIME_REF_MAGIC 0x7173da7e
+#define SCHEDULE_MAGIC 0x5c4ed01e
+#define NO_COMPRESSION_MAGIC 0x0c0de0ff
+
+// RTC user memory slots, 4 bytes each
+#define RTC_FLAG 64         // MAGIC_NUM once forecasts have been stored
+#define RTC_COUNT 65        // Number of stored forecasts
+#define RTC_FAILURES 66     // Failed fetches in a row
+#define RTC_FORECASTS 67
+#define RTC_VALIDATORS \
+    (RTC_FORECASTS + FORECAST_MAX_COUNT * sizeof(weather_t) / 4)
+#define RTC_CLOCK (RTC_VALIDATORS + sizeof(validators_t) / 4)
+#define RTC_DNS_CACHE (RTC_CLOCK + RTC_CLOCK_SLOTS)
+#define RTC_FETCH_LOG (RTC_DNS_CACHE + DNS_CACHE_SLOTS)
+#define RTC_TIME_REF (RTC_FETCH_LOG + sizeof(fetch_log_t) / 4)
+#define RTC_WIFI (RTC_TIME_REF + sizeof(time_ref_t) / 4)
+#define RTC_SCHEDULE (RTC_WIFI + WIFI_STATION_CACHE_SLOTS)
+// NO_COMPRESSION_MAGIC once a compressed response couldn't be decoded
+#define RTC_NO_COMPRESSION (RTC_SCHEDULE + sizeof(fetch_schedule_t) / 4)
+
+// Identify the stored forecasts. The validators from the response headers
+// make the next request conditional, the hash catches unchanged forecasts
+// from servers that don't send validators.
+typedef struct {
+    uint32_t query_hash;        // Of the URL the validators are for
+    uint32_t forecast_hash;
+    char etag[48];              // Same sizes as in http_header
+    char last_modified[32];
+} validators_t;
+
+// Where the time of a fetch went. The phases are milliseconds after the DNS
+// lookup started, PHASE_NOT_REACHED if the fetch didn't get that far.
+#define PHASE_NOT_REACHED 0xffff
+typedef struct {
+    uint16_t dns;
+    uint16_t connect;
+    uint16_t sent;
+    uint16_t first_byte;
+    uint16_t header;
+    uint16_t first_body_byte;
+    uint16_t last_byte;
+    int16_t status;             // HTTP status, 0 without a response
+    uint32_t bytes;
+    uint16_t pbufs;
+    uint16_t result;            // fetch_result_t
+} fetch_timing_t;
+
+// The last fetches in a ring, dumped over the UART on a display wake
+typedef struct {
+    uint32_t magic;
+    uint32_t next;              // Index of the oldest entry
+    fetch_timing_t fetches[FETCH_LOG_LENGTH];
+} fetch_log_t;
+
+// Server time from the Date header of the last response and the RTC clock
+// at the time, the current time is counted from them
+typedef struct {
+    uint32_t magic;
+    uint32_t time;
+    uint32_t clock;             // Seconds of rtc_clock_us()
+} time_ref_t;
+
 
 os_timer_t timeout_timer;
 
 u8g2_t u8g2;
 weather_parser_t wparser;
 bool idle_fetch;
+validators_t stored_validators;     // Of the forecasts in RTC, or empty
+validators_t new_validators;        // Of the response being received
+char fetch_headers[160];
+char owmap_query[160];
+fetch_timing_t fetch_timing;        // Of the fetch in progress
+inflate_t *inflater;        // Followed by its window, NULL if not allocated
+bool body_encoded;          // Whether the body goes through the inflater
+bool decode_failed;         // The response was compressed in a way the
+                            // inflater couldn't decode
 
 void sleep_timeout(uint32_t timeout);
+void do_owmap_query(void);
 
 void oled_draw_forecast(int x, int y, const weather_t *forecast,
     bool draw_weekday) {
@@ -82,18 +167,17 @@ void oled_draw_forecasts(const weather_t *forecasts, int n_forecasts) {
     u8g2_ClearBuffer(&u8g2);
 
     int j, c;
-    weather_t my_forecasts[3];
-    for (j = 0, c = 0; j < n_forecasts && c < 3; ++j) {
-        struct tm *dt = gmtime(&forecasts[j].time);
-        if (dt->tm_hour <= 18 && dt->tm_hour >= 9) {
+    weather_t my_forecasts[DAYTIME_FORECASTS];
+    for (j = 0, c = 0; j < n_forecasts && c < DAYTIME_FORECASTS; ++j) {
+        if (is_daytime(forecasts[j].time)) {
             my_forecasts[c] = forecasts[j];
             c += 1;
         }
     }
-    if (c < 3) return;
+    if (c < DAYTIME_FORECASTS) return;
 
     int prev_wday = 7;
-    for (int i = 0; i < 3; ++i) {
+    for (int i = 0; i < DAYTIME_FORECASTS; ++i) {
         struct tm *dt = gmtime(&my_forecasts[i].time);
         oled_draw_forecast(2 + i*46, 0, &my_forecasts[i], dt->tm_wday != prev_wday);
         prev_wday = dt->tm_wday;
@@ -109,12 +193,17 @@ void oled_init(void) {
 }
 
 void forecast_display() {
+    uint32_t flag = 0;
     uint32_t n_forecasts = 0;
-    if (system_rtc_mem_read(65, &n_forecasts, 4) && n_forecasts != 0) {
+    if (system_rtc_mem_read(RTC_FLAG, &flag, 4) && flag == MAGIC_NUM &&
+        system_rtc_mem_read(RTC_COUNT, &n_forecasts, 4) &&
+        n_forecasts != 0 && n_forecasts <= FORECAST_MAX_COUNT) {
         os_printf("Found %u forecasts\n", n_forecasts);
         wparser.forecast_count = n_forecasts;
-        system_rtc_mem_read(67, wparser.forecasts,
+        system_rtc_mem_read(RTC_FORECASTS, wparser.forecasts,
             n_forecasts * sizeof(weather_t));
+    } else {
+        n_forecasts = 0;
     }
     oled_init();
     oled_draw_forecasts(wparser.forecasts, n_forecasts);
@@ -132,45 +221,357 @@ void sleep_timer_cb(void *arg) {
     go_to_sleep(*timeout);
 }
 
+uint32_t data_fetch_interval = DATA_FETCH_INTERVAL;
+
+uint16_t phase_ms(uint32_t time, uint32_t start) {
+    if (time == 0) return PHASE_NOT_REACHED;
+    uint32_t ms = (time - start) / 1000;
+    return ms < PHASE_NOT_REACHED ? ms : PHASE_NOT_REACHED - 1;
+}
+
+void record_timing(const http_header *header) {
+    const http_timing *t = &header->timing;
+    fetch_timing.dns = phase_ms(t->dns_end, t->dns_start);
+    fetch_timing.connect = phase_ms(t->connected, t->dns_start);
+    fetch_timing.sent = phase_ms(t->request_sent, t->dns_start);
+    fetch_timing.first_byte = phase_ms(t->first_byte, t->dns_start);
+    fetch_timing.header = phase_ms(t->header_done, t->dns_start);
+    fetch_timing.first_body_byte = phase_ms(t->first_body_byte, t->dns_start);
+    fetch_timing.last_byte = phase_ms(t->last_byte, t->dns_start);
+    fetch_timing.status = header->status;
+    fetch_timing.bytes = t->bytes;
+    fetch_timing.pbufs = t->pbufs;
+}
+
+void read_fetch_log(fetch_log_t *log) {
+    if (!system_rtc_mem_read(RTC_FETCH_LOG, log, sizeof(*log)) ||
+        log->magic != FETCH_LOG_MAGIC || log->next >= FETCH_LOG_LENGTH) {
+        os_memset(log, 0, sizeof(*log));
+        log->magic = FETCH_LOG_MAGIC;
+    }
+}
+
+void append_fetch_log(fetch_result_t result) {
+    fetch_log_t log;
+    read_fetch_log(&log);
+    fetch_timing.result = result;
+    log.fetches[log.next] = fetch_timing;
+    log.next = (log.next + 1) % FETCH_LOG_LENGTH;
+    system_rtc_mem_write(RTC_FETCH_LOG, &log, sizeof(log));
+}
+
+void dump_fetch_log(void) {
+    fetch_log_t log;
+    read_fetch_log(&log);
+    for (int i = 0; i < FETCH_LOG_LENGTH; i++) {
+        const fetch_timing_t *f =
+            &log.fetches[(log.next + i) % FETCH_LOG_LENGTH];
+        if (f->pbufs == 0 && f->status == 0 && f->result == 0) continue;
+        // Milliseconds, 65535 if not reached
+        os_printf("Fetch %d: dns %u connect %u sent %u first byte %u "
+            "header %u body %u last byte %u, status %d, %u bytes in %u pbufs, "
+            "result %u\n", i - FETCH_LOG_LENGTH, f->dns, f->connect, f->sent,
+            f->first_byte, f->header, f->first_body_byte, f->last_byte,
+            f->status, f->bytes, f->pbufs, f->result);
+    }
+}
+
+// Seconds since the epoch, 0 if no response has told the time since power up
+time_t current_time(void) {
+    time_ref_t ref;
+    uint32_t clock = rtc_clock_us() / 1000000;
+    if (!system_rtc_mem_read(RTC_TIME_REF, &ref, sizeof(ref)) ||
+        ref.magic != TIME_REF_MAGIC || clock < ref.clock) {
+        return 0;
+    }
+    return ref.time + (clock - ref.clock);
+}
+
+void save_time_ref(const char *date) {
+    time_ref_t ref;
+    ref.time = parse_http_date(date);
+    if (ref.time == 0) return;
+    ref.magic = TIME_REF_MAGIC;
+    ref.clock = rtc_clock_us() / 1000000;
+    system_rtc_mem_write(RTC_TIME_REF, &ref, sizeof(ref));
+}
+
+void read_schedule(fetch_schedule_t *schedule) {
+    if (!system_rtc_mem_read(RTC_SCHEDULE, schedule, sizeof(*schedule)) ||
+        schedule->magic != SCHEDULE_MAGIC) {
+        os_memset(schedule, 0, sizeof(*schedule));
+        schedule->magic = SCHEDULE_MAGIC;
+    }
+}
+
+// Time from which the stored forecasts start to be out of date, 0 if there
+// are none. A fetch after the first one is over gets a list without it.
+time_t forecasts_stale_time(void) {
+    uint32_t flag = 0;
+    weather_t first;
+    if (system_rtc_mem_read(RTC_FLAG, &flag, 4) && flag == MAGIC_NUM &&
+        system_rtc_mem_read(RTC_FORECASTS, &first, sizeof(first))) {
+        return first.time + FORECAST_INTERVAL;
+    }
+    return 0;
+}
+
+// Milliseconds to sleep after a fetch, the planned time is kept for
+// time_to_next_fetch(). Without the time the interval is DATA_FETCH_INTERVAL.
+uint32_t schedule_next_fetch(fetch_result_t result, uint32_t failures) {
+    fetch_schedule_t schedule;
+    read_schedule(&schedule);
+    uint32_t interval = fetch_schedule_next(&schedule, result, failures,
+        current_time(), forecasts_stale_time(),
+        system_get_chip_id() % FETCH_JITTER);
+    system_rtc_mem_write(RTC_SCHEDULE, &schedule, sizeof(schedule));
+    os_printf("Next fetch in %u s\n", interval / 1000);
+    return interval;
+}
+
+// Milliseconds left until the planned fetch, for sleeping after the
+// forecasts were shown without fetching
+uint32_t time_to_next_fetch(void) {
+    fetch_schedule_t schedule;
+    read_schedule(&schedule);
+    return fetch_schedule_remaining(&schedule, current_time());
+}
+
+// Stores the forecasts if they were fetched and changed. Otherwise the
+// previous ones are kept and after a failure the next fetch is delayed more.
+void fetch_done(fetch_result_t result) {
+    os_timer_disarm(&timeout_timer);
+    os_free(inflater);
+    inflater = NULL;
+    append_fetch_log(result);
+
+    uint32_t failures = 0;
+    if (result == FETCH_UPDATED) {
+        uint32_t data_length = wparser.forecast_count;
+        uint32_t flag = 0;
+        system_rtc_mem_write(RTC_FLAG, &flag, 4);
+        system_rtc_mem_write(RTC_COUNT, &data_length, 4);
+        system_rtc_mem_write(RTC_FORECASTS, wparser.forecasts,
+            data_length * sizeof(weather_t));
+        system_rtc_mem_write(RTC_VALIDATORS, &new_validators,
+            sizeof(new_validators));
+        flag = MAGIC_NUM;
+        system_rtc_mem_write(RTC_FLAG, &flag, 4);
+        os_printf("Fetched %u forecasts\n", data_length);
+    } else if (result == FETCH_UNCHANGED) {
+        os_printf("Forecasts unchanged\n");
+    } else {
+        // The slot is garbage after power up, the clamp takes care of it
+        system_rtc_mem_read(RTC_FAILURES, &failures, 4);
+        failures = failures < DATA_FETCH_MAX_BACKOFF ?
+            failures + 1 : DATA_FETCH_MAX_BACKOFF;
+        os_printf("Fetch failed, %u in a row\n", failures);
+        if (fetch_timing.status == 0) {
+            // Nothing came back, the cached addresses may be the reason
+            wifi_station_forget();
+            dns_cache_forget(OWMAP_HOST);
+        }
+    }
+    system_rtc_mem_write(RTC_FAILURES, &failures, 4);
+    data_fetch_interval = schedule_next_fetch(result, failures);
+
+    if (!idle_fetch) {
+        forecast_display();
+    } else {
+        go_to_sleep(data_fetch_interval);
+    }
+}
+
+// Copies a header value that can be sent back as is, or clears dst
+void copy_validator(char *dst, size_t size, const char *src) {
+    size_t len = os_strlen(src);
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (src[i] < 0x20 || src[i] > 0x7e) break;
+    }
+    // A value that filled the field may have been truncated
+    if (i != len || len >= size - 1) {
+        len = 0;
+    }
+    os_memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Loads the validators of the stored forecasts and makes the request
+// headers out of them. The ETag and date are only sent back for the same
+// query, the response to another one is a different document.
+void load_validators(uint32_t query_hash) {
+    uint32_t flag = 0;
+    validators_t rtc;
+    os_memset(&stored_validators, 0, sizeof(stored_validators));
+    // Without stored forecasts a 304 response would leave nothing to show
+    if (system_rtc_mem_read(RTC_FLAG, &flag, 4) && flag == MAGIC_NUM &&
+        system_rtc_mem_read(RTC_VALIDATORS, &rtc, sizeof(rtc))) {
+        // Terminate in case the slots were written by an older firmware
+        rtc.etag[sizeof(rtc.etag) - 1] = '\0';
+        rtc.last_modified[sizeof(rtc.last_modified) - 1] = '\0';
+        stored_validators.query_hash = rtc.query_hash;
+        stored_validators.forecast_hash = rtc.forecast_hash;
+        if (rtc.query_hash == query_hash) {
+            copy_validator(stored_validators.etag,
+                sizeof(stored_validators.etag), rtc.etag);
+            copy_validator(stored_validators.last_modified,
+                sizeof(stored_validators.last_modified), rtc.last_modified);
+        }
+    }
+
+    char *h = fetch_headers;
+    *h = '\0';
+    if (stored_validators.etag[0] != '\0') {
+        h += os_sprintf(h, "If-None-Match: %s\r\n", stored_validators.etag);
+    }
+    if (stored_validators.last_modified[0] != '\0') {
+        h += os_sprintf(h, "If-Modified-Since: %s\r\n",
+            stored_validators.last_modified);
+    }
+}
+
+bool compression_disabled(void) {
+    uint32_t magic = 0;
+    return system_rtc_mem_read(RTC_NO_COMPRESSION, &magic, 4) &&
+        magic == NO_COMPRESSION_MAGIC;
+}
+
+// Allocates the decoder for compressed responses and asks for them
+void accept_encoding(void) {
+    if (GZIP_WINDOW_BITS == 0 || compression_disabled()) return;
+    inflater = (inflate_t *)os_malloc(sizeof(inflate_t) +
+        INFLATE_WINDOW_SIZE(GZIP_WINDOW_BITS));
+    if (inflater != NULL) {
+        os_sprintf(fetch_headers + os_strlen(fetch_headers),
+            "Accept-Encoding: gzip, deflate\r\n");
+    }
+}
+
+bool parse_body(const char *data, size_t len, void *arg) {
+    // Either everything needed is here or the response isn't a forecast,
+    // in both cases the rest is of no use
+    return weather_stream_parse(&wparser, data, len) == WEATHER_PARSE_MORE;
+}
+
+// Sets up decoding for the content encoding of the response. Returns false
+// if the body can't be decoded.
+bool start_decoding(const char *encoding) {
+    inflate_format_t format;
+    body_encoded = false;
+    if (encoding[0] == '\0' || os_strcmp(encoding, "identity") == 0) {
+        return true;
+    } else if (os_strcmp(encoding, "gzip") == 0 ||
+        os_strcmp(encoding, "x-gzip") == 0) {
+        format = INFLATE_FORMAT_GZIP;
+    } else if (os_strcmp(encoding, "deflate") == 0) {
+        format = INFLATE_FORMAT_ZLIB;
+    } else {
+        return false;
+    }
+    if (inflater == NULL) return false;
+    inflate_init(inflater, format, (uint8_t *)(inflater + 1),
+        GZIP_WINDOW_BITS, parse_body, NULL);
+    body_encoded = true;
+    return true;
+}
+
 void http_get_callback(char * response_body, int http_status,
-    char * response_headers, int body_size) {
+    const http_header * response_header, int body_size) {
     static int current_status = 0;
-    if (response_headers != NULL) {
+    if (http_status == HTTP_STATUS_GENERIC_ERROR) {
+        // DNS failure, there is no connection to wait for
+        fetch_done(FETCH_FAILED);
+        return;
+    }
+    if (http_status == HTTP_STATUS_DISCONNECT) {
+        record_timing(response_header);
+    } else if (http_status > 0) {
         current_status = http_status;
+        save_time_ref(response_header->date);
         weather_parser_init(&wparser);
+        copy_validator(new_validators.etag, sizeof(new_validators.etag),
+            response_header->etag);
+        copy_validator(new_validators.last_modified,
+            sizeof(new_validators.last_modified),
+            response_header->last_modified);
+        if (current_status == 304) {
+            // Not modified, there is no body to wait for
+            return;
+        } else if (current_status != 200) {
+            os_printf("HTTP status %d\n", current_status);
+            http_abort();
+            return;
+        } else if (!start_decoding(response_header->content_encoding)) {
+            os_printf("Unsupported encoding %s\n",
+                response_header->content_encoding);
+            decode_failed = true;
+            http_abort();
+            return;
+        }
     }
-    if (current_status == 200 && response_body != NULL) {
-        char ch;
-        while ((ch = *(response_body++)) != '\0') {
-            weather_stream_parse(&wparser, ch);
+    if (current_status == 200 && response_body != NULL && body_size > 0) {
+        bool more;
+        if (body_encoded) {
+            // The parser is fed through the inflater
+            inflate_result_t result = inflate_stream(inflater, response_body,
+                body_size);
+            more = result == INFLATE_MORE || result == INFLATE_DONE;
+            if (result == INFLATE_ERROR) {
+                os_printf("Can't decode the response\n");
+                decode_failed = true;
+            }
+        } else {
+            more = parse_body(response_body, body_size, NULL);
+        }
+        if (!more) {
+            http_abort();
         }
     }
 
     if (http_status == HTTP_STATUS_DISCONNECT) {
-        os_timer_disarm(&timeout_timer);
-        uint32_t data_length = wparser.forecast_count;
-        uint32_t flag = 0;
-        system_rtc_mem_write(64, &flag, 4);
-        system_rtc_mem_write(65, &data_length, 4);
-        system_rtc_mem_write(67, wparser.forecasts, data_length * sizeof(weather_t));
-        flag = MAGIC_NUM;
-        system_rtc_mem_write(64, &flag, 4);
-        os_printf("Fetched %u forecasts\n", data_length);
-        if (!idle_fetch) {
-            forecast_display();
+        // Only a conditional request may be answered with 304
+        if (current_status == 304 && (stored_validators.etag[0] != '\0' ||
+            stored_validators.last_modified[0] != '\0')) {
+            fetch_done(FETCH_UNCHANGED);
+        } else if (current_status == 200 && weather_parse_complete(&wparser)) {
+            new_validators.forecast_hash = hash_update(HASH_INIT,
+                wparser.forecasts, wparser.forecast_count * sizeof(weather_t));
+            fetch_done(new_validators.forecast_hash ==
+                stored_validators.forecast_hash ?
+                FETCH_UNCHANGED : FETCH_UPDATED);
+        } else if (decode_failed && !compression_disabled()) {
+            // Once more without Accept-Encoding, the timeout still runs
+            uint32_t magic = NO_COMPRESSION_MAGIC;
+            system_rtc_mem_write(RTC_NO_COMPRESSION, &magic, 4);
+            append_fetch_log(FETCH_FAILED);
+            os_free(inflater);
+            inflater = NULL;
+            do_owmap_query();
         } else {
-            go_to_sleep(DATA_FETCH_INTERVAL);
+            fetch_done(FETCH_FAILED);
         }
     }
 }
 
-char owmap_query[128];
 void do_owmap_query(void) {
-    os_sprintf(owmap_query,
-        "http://api.openweathermap.org/data/2.5/forecast?id=%s&appid=%s&units=metric",
-        OWMAP_CITY_ID, OWMAP_API_KEY);
-
-    http_get(owmap_query, "", http_get_callback);  // Example domain for testing for now - this sends chunked responses
+    os_memset(&fetch_timing, 0, sizeof(fetch_timing));
+    decode_failed = false;
+    int count = forecast_count_needed(current_time());
+    if (!build_owmap_query(owmap_query, sizeof(owmap_query), OWMAP_CITY_ID,
+        OWMAP_API_KEY, count, OWMAP_UNITS, OWMAP_LANG)) {
+        os_printf("Forecast query too long\n");
+        fetch_done(FETCH_FAILED);
+        return;
+    }
+    os_printf("Requesting %d forecasts\n", count);
+
+    os_memset(&new_validators, 0, sizeof(new_validators));
+    new_validators.query_hash = hash_update(HASH_INIT, owmap_query,
+        os_strlen(owmap_query));
+    load_validators(new_validators.query_hash);
+    accept_encoding();
+    http_get(owmap_query, fetch_headers, http_get_callback);  // Example domain for testing for now - this sends chunked responses
 }
 
 void ntp_cb(time_t timestamp, struct tm *dt) {
@@ -189,7 +590,6 @@ void ntp_dns_cb(uint8_t *addr) {
     ntp_get_time(addr, ntp_cb);
 }
 
-uint32_t data_fetch_interval = DATA_FETCH_INTERVAL;
 void sleep_timeout(uint32_t timeout) {
     os_timer_disarm(&timeout_timer);
     os_timer_setfn(&timeout_timer, (os_timer_func_t *)sleep_timer_cb,
@@ -215,6 +615,9 @@ void user_init(void) {
     uint16_t adc = system_adc_read();
     system_update_cpu_freq(80);
     uart_init(BIT_RATE_115200, BIT_RATE_115200);
+    rtc_clock_init(RTC_CLOCK);
+    dns_cache_init(RTC_DNS_CACHE);
+    wifi_station_cache_init(RTC_WIFI);
 
     u8g2_Setup_ssd1306_i2c_128x64_noname_f(&u8g2, U8G2_R0,
         u8x8_byte_brzo_sw_i2c,
@@ -230,8 +633,10 @@ void user_init(void) {
         fetch_weather_data();
     } else {
         uint32_t flag = 0;
-        if (system_rtc_mem_read(64, &flag, 4) && flag == MAGIC_NUM) {
+        dump_fetch_log();
+        if (system_rtc_mem_read(RTC_FLAG, &flag, 4) && flag == MAGIC_NUM) {
             os_printf("Displaying data directly from RTC...\n");
+            data_fetch_interval = time_to_next_fetch();
             forecast_display();
         } else {
             os_printf("Going to display data, fetching first...\n");